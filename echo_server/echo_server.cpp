@@ -236,6 +236,9 @@ int main(int argc, const char* argv[])
 		{
 			printf("normal server, link #: " ST_ASIO_SF ", invalid links: " ST_ASIO_SF "\n", server_.size(), server_.invalid_object_size());
 			printf("echo server, link #: " ST_ASIO_SF ", invalid links: " ST_ASIO_SF "\n", echo_server_.size(), echo_server_.invalid_object_size());
+			for (size_t i = 0; i < echo_server_.acceptor_num(); ++i)
+				printf("echo server, acceptor " ST_ASIO_SF " accepted " ST_ASIO_SF " link(s) (" ST_ASIO_SF " by batch), pending accept: " ST_ASIO_SF " / " ST_ASIO_SF ", rate: %f/s\n",
+					i, echo_server_.accept_num(i), echo_server_.batch_accept_num(i), echo_server_.pending_accept_num(i), echo_server_.accept_concurrency(i), echo_server_.accept_rate(i));
 			puts("");
 			puts(echo_server_.get_statistic().to_string().data());
 		}
@@ -274,6 +277,10 @@ int main(int argc, const char* argv[])
 				server_.do_something_to_all(boost::bind((bool (normal_server_socket::*)(packer::msg_ctype&, bool)) &normal_server_socket::direct_send_msg, _1, boost::cref(msg), false));
 			*/
 			/*
+			//the same as above, but sockets are visited by service threads in parallel without holding object_pool's locks.
+			server_.shared_broadcast_msg(str.data(), str.size() + 1);
+			*/
+			/*
 			//if demo client is using stream_unpacker
 			if (!str.empty())
 				server_.do_something_to_all(boost::bind((bool (normal_server_socket::*)(packer::msg_ctype&, bool)) &normal_server_socket::direct_send_msg, _1, boost::cref(str), false));
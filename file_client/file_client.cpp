@@ -10,6 +10,9 @@
 #define ST_ASIO_DEFAULT_UNPACKER replaceable_unpacker<>
 #define ST_ASIO_RECV_BUFFER_TYPE std::vector<boost::asio::mutable_buffer> //scatter-gather buffer, it's very useful under certain situations (for example, ring buffer).
 #define ST_ASIO_SCATTERED_RECV_BUFFER //used by unpackers, not belongs to st_asio_wrapper
+//#define ST_ASIO_MAPPED_FILE_RECV //used by unpackers, not belongs to st_asio_wrapper, see mapped_data_unpacker for more details.
+//receive file content into mapped file pages directly, this saves one copy, but every page costs a page fault, on ext4 and
+//loopback, it's about 30% slower than receiving into a buffer and then pwrite, so measure it on your system before using it.
 //configuration
 
 #include "file_client.h"
@@ -25,6 +28,7 @@ boost::atomic_int_fast64_t received_size;
 #else
 atomic<boost::int_fast64_t> received_size;
 #endif
+range_scheduler file_ranges;
 
 int main(int argc, const char* argv[])
 {
@@ -30,18 +30,19 @@ public:
 	virtual void reset() {clear(); client_socket::reset();}
 
 	void set_index(int index_) {index = index_;}
+	//the file must exist (see file_client::get_file), if this link is still busy with the last transmission (draining a range whose
+	//pieces have been stolen), it will join the new transmission after that (see join_pending_file).
 	bool get_file(const std::string& file_name)
 	{
 		assert(!file_name.empty());
 
 		if (TRANS_IDLE != state)
-			return false;
-
-		if (0 == id())
-			file = fopen(file_name.data(), "w+b");
-		else
-			file = fopen(file_name.data(), "r+b");
+		{
+			pending_file = file_name;
+			return true;
+		}
 
+		file = fopen(file_name.data(), "r+b");
 		if (NULL == file)
 		{
 			printf("can't create file %s.\n", file_name.data());
@@ -87,13 +88,25 @@ protected:
 		memcpy(boost::next(buffer, ORDER_LEN), &id, sizeof(boost::uint_fast64_t));
 		send_msg(buffer, sizeof(buffer), true);
 
+		//join the unfinished transmission again after reconnected, its pieces have been handed out again (see on_close)
+		std::string file_name;
+		if (file_ranges.unfinished(file_name))
+			get_file(file_name);
+
 		client_socket::on_connect();
 	}
 
+	//the link is broken and all async operations have finished, no pieces will be received by this link any more
+	virtual void on_close() {clear(); client_socket::on_close();}
+
 private:
 	void clear()
 	{
+		if (TRANS_BUSY == state)
+			file_ranges.link_broken(index);
+
 		state = TRANS_IDLE;
+		pending_file.clear();
 		if (NULL != file)
 		{
 			fclose(file);
@@ -104,12 +117,55 @@ private:
 	}
 	void trans_end() {clear();}
 
+	//a new transmission began while this link was busy with the last one, now the last one is over (or can be given up), join the new one
+	bool join_pending_file()
+	{
+		if (pending_file.empty())
+			return false;
+
+		std::string file_name;
+		file_name.swap(pending_file);
+		trans_end();
+		get_file(file_name);
+		return true;
+	}
+
+	//ranges are handed out on demand (see range_scheduler), end the transmission if nothing left
+	void request_next_range()
+	{
+		fl_type piece, piece_num;
+		if (!file_ranges.next_range(index, piece, piece_num))
+		{
+			trans_end();
+			return;
+		}
+
+		char buffer[ORDER_LEN + OFFSET_LEN + DATA_LEN];
+		*buffer = 4; //head
+		memcpy(boost::next(buffer, ORDER_LEN), &piece, OFFSET_LEN);
+		memcpy(boost::next(buffer, ORDER_LEN + OFFSET_LEN), &piece_num, DATA_LEN);
+
+		state = TRANS_BUSY;
+		send_msg(buffer, sizeof(buffer), true);
+
+#ifdef ST_ASIO_MAPPED_FILE_RECV
+		BOOST_AUTO(mapped_unpacker, boost::make_shared<mapped_data_unpacker>(file, index, piece, piece_num, file_ranges.range_length(piece, piece_num)));
+		if (mapped_unpacker->mapped())
+		{
+			unpacker(mapped_unpacker);
+			return;
+		}
+#endif
+		unpacker(boost::make_shared<data_unpacker>(file, index, piece, piece_num));
+	}
+
 	void handle_msg(out_msg_ctype& msg)
 	{
 		if (TRANS_BUSY == state)
 		{
 			assert(msg.empty());
-			trans_end();
+			if (!join_pending_file())
+				request_next_range();
 			return;
 		}
 		else if (msg.size() <= ORDER_LEN)
@@ -121,14 +177,17 @@ private:
 		switch (*msg.data())
 		{
 		case 0:
-			if (ORDER_LEN + DATA_LEN == msg.size() && NULL != file && TRANS_PREPARE == state)
+			if (ORDER_LEN + DATA_LEN == msg.size() && NULL != file && TRANS_PREPARE == state && !join_pending_file())
 			{
 				fl_type length;
 				memcpy(&length, boost::next(msg.data(), ORDER_LEN), DATA_LEN);
 				if (-1 == length)
 				{
 					if (0 == index)
+					{
 						puts("get file failed!");
+						file_ranges.reset(0); //nothing to resume
+					}
 					trans_end();
 				}
 				else
@@ -136,26 +195,21 @@ private:
 					if (0 == index)
 						file_size = length;
 
-					fl_type my_length = length / link_num;
-					fl_type offset = my_length * index;
-
-					if (link_num - 1 == index)
-						my_length = length - offset;
-					if (my_length > 0)
+					if (!file_ranges.set_file_length(length, file))
 					{
-						char buffer[ORDER_LEN + OFFSET_LEN + DATA_LEN];
-						*buffer = 1; //head
-						memcpy(boost::next(buffer, ORDER_LEN), &offset, OFFSET_LEN);
-						memcpy(boost::next(buffer, ORDER_LEN + OFFSET_LEN), &my_length, DATA_LEN);
-
-						state = TRANS_BUSY;
-						send_msg(buffer, sizeof(buffer), true);
-
-						fseeko(file, offset, SEEK_SET);
-						unpacker(boost::make_shared<data_unpacker>(file, my_length));
+						puts("can't empty the file!");
+						trans_end();
+						return;
 					}
-					else
+#ifdef ST_ASIO_MAPPED_FILE_RECV
+					if (!resize_file(file, length))
+					{
+						printf("can't resize file to " ST_ASIO_LLF " bytes.\n", (boost::uint_fast64_t) length);
 						trans_end();
+						return;
+					}
+#endif
+					request_next_range();
 				}
 			}
 			break;
@@ -170,6 +224,7 @@ private:
 
 private:
 	int index;
+	std::string pending_file; //see join_pending_file
 };
 
 class file_client : public multi_client_base<file_socket>
@@ -188,8 +243,14 @@ public:
 			printf("file transfer is ongoing for file %s", file_name.data());
 		else
 		{
-			printf("transfer %s begin.\n", file_name.data());
-			if (find(0)->get_file(file_name))
+			bool resuming = file_ranges.reset(link_num, file_name);
+			printf("transfer %s begin%s.\n", file_name.data(), resuming ? " (resuming)" : "");
+			FILE* file = fopen(file_name.data(), resuming ? "r+b" : "w+b"); //all links open the file without emptying it
+			if (NULL != file)
+				fclose(file);
+
+			//every link takes part in, busy links (still draining the last transmission) will join later, see file_socket::join_pending_file
+			if (NULL != file && find(0)->get_file(file_name))
 			{
 				do_something_to_all(boost::lambda::if_then(0U != boost::lambda::bind((boost::uint_fast64_t (file_socket::*)() const) &file_socket::id, *boost::lambda::_1),
 					boost::lambda::bind(&file_socket::get_file, *boost::lambda::_1, file_name)));
@@ -0,0 +1,250 @@
+#ifndef RANGE_SCHEDULER_H_
+#define RANGE_SCHEDULER_H_
+
+#include <vector>
+#include <boost/thread.hpp>
+
+#include "../file_server/common.h"
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#else
+#include <io.h>
+#define ftruncate _chsize_s
+#endif
+
+#define RANGE_PIECE_NUM		4 //the file is cut into ranges with this many pieces (see order 4)
+#define MIN_STEAL_PIECE_NUM	1 //only steal from ranges which still have at least twice this many pieces to receive
+#define MAX_STEAL_PIECE_NUM	8 //a link steals at most this many pieces in one transmission, stolen pieces are received twice (see below)
+#define PIECE_STATE_SUFFIX	".pieces"
+
+#if BOOST_VERSION >= 105300
+extern boost::atomic_int_fast64_t received_size;
+#else
+extern atomic<boost::int_fast64_t> received_size;
+#endif
+
+//the file is cut into many small ranges which are handed out on demand, so faster links will receive more ranges,
+//after all ranges been handed out, idle links steal the unreceived half (in pieces) of the biggest range which is still being received.
+//the victim still receives its whole range from the server (we cannot stop it), but it will drop the stolen pieces, so every link
+//steals no more than MAX_STEAL_PIECE_NUM pieces in one transmission, this bounds the duplicate data to MAX_STEAL_PIECE_NUM * PIECE_SIZE per link.
+//
+//pieces which failed to be verified or were being received by a broken link will be handed out again, and verified pieces
+//are recorded in a state file (file name + PIECE_STATE_SUFFIX, the file length + one byte per piece), so a broken transmission
+//can be resumed by getting the same file again, only missing pieces will be requested. the state file will be removed after
+//all pieces been verified.
+//all functions are thread safe.
+class range_scheduler
+{
+public:
+	range_scheduler() : state_file(NULL) {reset(0);}
+	~range_scheduler() {close_state_file();}
+
+	//links are indexed by [0, link_num), return true if the transmission can be resumed (the state file exists)
+	bool reset(int link_num, const std::string& file_name_ = std::string())
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		close_state_file();
+
+		file_name = file_name_;
+		file_length = saved_length = -1;
+		next_piece = piece_num = done_num = 0;
+		pieces.clear();
+		links.assign(link_num, link_range());
+
+		if (!file_name.empty())
+		{
+			state_file = fopen((file_name + PIECE_STATE_SUFFIX).data(), "r+b");
+			if (NULL != state_file && OFFSET_LEN != fread(&saved_length, 1, OFFSET_LEN, state_file))
+				saved_length = -1;
+		}
+
+		return NULL != state_file;
+	}
+
+	//the file name if the transmission has not finished
+	bool unfinished(std::string& file_name_) {boost::lock_guard<boost::mutex> lock(mutex); file_name_ = file_name; return !file_name.empty();}
+
+	//the file length is known, only the first invocation takes effect.
+	//if the transmission can not be resumed (the length changed), file will be emptied, this is safe because all links
+	//invoke this function before writing anything.
+	bool set_file_length(fl_type length, FILE* file)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		if (file_length >= 0)
+			return true;
+
+		file_length = length;
+		piece_num = (length + PIECE_SIZE - 1) / PIECE_SIZE;
+		pieces.assign((size_t) piece_num, PIECE_MISSING);
+
+		if (length == saved_length && (0 == piece_num || piece_num == (fl_type) fread(&pieces.front(), 1, (size_t) piece_num, state_file)))
+		{
+			for (fl_type piece = 0; piece < piece_num; ++piece)
+				if (PIECE_DONE == pieces[(size_t) piece])
+				{
+					++done_num;
+					received_size += piece_length(piece);
+				}
+				else
+					pieces[(size_t) piece] = PIECE_MISSING;
+		}
+		else
+		{
+			if (NULL != state_file && 0 != ftruncate(fileno(file), 0)) //file was opened without being emptied, see file_client::get_file
+				return false;
+
+			pieces.assign((size_t) piece_num, PIECE_MISSING);
+			close_state_file();
+			create_state_file();
+		}
+
+		if (done_num == piece_num)
+			finish();
+		return true;
+	}
+
+	//get the next range for the link, return false if nothing left
+	bool next_range(int index, fl_type& piece, fl_type& num)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		assert(index >= 0 && (size_t) index < links.size() && file_length >= 0);
+
+		link_range& range = links[index];
+		while (next_piece < piece_num && PIECE_MISSING != pieces[(size_t) next_piece])
+			++next_piece;
+
+		if (next_piece < piece_num)
+		{
+			range.next = range.end = next_piece;
+			while (range.end < piece_num && range.end - range.next < RANGE_PIECE_NUM && PIECE_MISSING == pieces[(size_t) range.end])
+				pieces[(size_t) range.end++] = PIECE_ASSIGNED;
+			next_piece = range.end;
+		}
+		else
+		{
+			BOOST_AUTO(victim, links.end());
+			for (BOOST_AUTO(iter, links.begin()); range.stolen < MAX_STEAL_PIECE_NUM && iter != links.end(); ++iter)
+				if (iter->end - iter->next >= 2 * MIN_STEAL_PIECE_NUM && (links.end() == victim || iter->end - iter->next > victim->end - victim->next))
+					victim = iter;
+			if (links.end() == victim)
+			{
+				range.next = range.end = 0;
+				return false;
+			}
+
+			fl_type num = std::min((victim->end - victim->next) / 2, MAX_STEAL_PIECE_NUM - range.stolen);
+			range.end = victim->end;
+			range.next = victim->end = victim->end - num;
+			range.stolen += num;
+		}
+
+		piece = range.next;
+		num = range.end - range.next;
+		return true;
+	}
+
+	fl_type piece_length(fl_type piece) const {return range_length(piece, 1);}
+	fl_type range_length(fl_type piece, fl_type num) const {return std::min((piece + num) * PIECE_SIZE, file_length) - piece * PIECE_SIZE;}
+
+	//the link starts to receive the piece, return false if it has been stolen by other links (then just drop it)
+	bool begin_piece(int index, fl_type piece)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		assert(index >= 0 && (size_t) index < links.size());
+
+		link_range& range = links[index];
+		if (piece != range.next || range.next >= range.end)
+			return false;
+
+		range.receiving = range.next++;
+		return true;
+	}
+
+	//the piece (begin_piece returned true) has been received, verified or not
+	void end_piece(int index, fl_type piece, bool verified)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		assert(index >= 0 && (size_t) index < links.size() && piece == links[index].receiving);
+
+		links[index].receiving = -1;
+		if (!verified)
+		{
+			printf("\npiece " ST_ASIO_LLF " failed to be verified, receive it again.\n", (boost::uint_fast64_t) piece);
+			release_piece(piece);
+			return;
+		}
+
+		pieces[(size_t) piece] = PIECE_DONE;
+		++done_num;
+		received_size += piece_length(piece);
+
+		if (NULL != state_file)
+		{
+			char state = PIECE_DONE;
+			if (0 != fseeko(state_file, OFFSET_LEN + piece, SEEK_SET) || 1 != fwrite(&state, 1, 1, state_file) || 0 != fflush(state_file))
+				close_state_file(); //can not be resumed any more, but the transmission still can go on
+		}
+
+		if (done_num == piece_num)
+			finish();
+	}
+
+	//the link is broken, hand out its pieces again
+	void link_broken(int index)
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		if (index < 0 || (size_t) index >= links.size())
+			return;
+
+		link_range& range = links[index];
+		if (range.receiving >= 0)
+			release_piece(range.receiving);
+		for (; range.next < range.end; ++range.next)
+			release_piece(range.next);
+		range.next = range.end = 0;
+		range.receiving = -1;
+	}
+
+private:
+	void release_piece(fl_type piece) {pieces[(size_t) piece] = PIECE_MISSING; next_piece = std::min(next_piece, piece);}
+
+	void create_state_file()
+	{
+		state_file = fopen((file_name + PIECE_STATE_SUFFIX).data(), "w+b");
+		if (NULL == state_file)
+			return;
+
+		if (OFFSET_LEN != fwrite(&file_length, 1, OFFSET_LEN, state_file) ||
+			(piece_num > 0 && piece_num != (fl_type) fwrite(&pieces.front(), 1, (size_t) piece_num, state_file)) || 0 != fflush(state_file))
+			close_state_file();
+	}
+
+	void close_state_file() {if (NULL != state_file) fclose(state_file); state_file = NULL;}
+
+	void finish()
+	{
+		close_state_file();
+		remove((file_name + PIECE_STATE_SUFFIX).data());
+		file_name.clear();
+	}
+
+private:
+	enum PIECE_STATE {PIECE_MISSING, PIECE_DONE, PIECE_ASSIGNED}; //PIECE_DONE must be 1, it's what the state file stores
+	struct link_range
+	{
+		fl_type next, end; //[next, end) has not been received
+		fl_type receiving; //the piece which is being received, -1 means none
+		fl_type stolen; //how many pieces have been stolen by this link, see MAX_STEAL_PIECE_NUM
+		link_range() : next(0), end(0), receiving(-1), stolen(0) {}
+	};
+
+	boost::mutex mutex;
+	std::string file_name;
+	FILE* state_file;
+	fl_type file_length, saved_length, next_piece, piece_num, done_num;
+	std::vector<char> pieces;
+	std::vector<link_range> links;
+};
+
+#endif //RANGE_SCHEDULER_H_
@@ -5,40 +5,62 @@
 using namespace st_asio_wrapper;
 using namespace st_asio_wrapper::tcp;
 
-#include "../file_server/common.h"
+#include "range_scheduler.h"
 
-#if BOOST_VERSION >= 105300
-extern boost::atomic_int_fast64_t received_size;
-#else
-extern atomic<boost::int_fast64_t> received_size;
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+#ifdef ST_ASIO_MAPPED_FILE_RECV
+#ifdef _MSC_VER
+	#error mapped file receiving is not supported on Windows.
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
-class data_unpacker : public i_unpacker<replaceable_buffer>
+extern range_scheduler file_ranges;
+
+//receive pieces (see order 4), every piece is followed by its hash, pieces are verified while they are being received,
+//so verifying doesn't need another pass over the file, and links verify their own pieces concurrently.
+//subclasses decide where the content will be received into and how to write it into the file.
+class piece_unpacker : public i_unpacker<replaceable_buffer>
 {
 public:
-	data_unpacker(FILE* file, fl_type data_len)  : _file(file), _data_len(data_len)
-	{
-		assert(NULL != _file);
-
-		buffer = new char[boost::asio::detail::default_max_transfer_size];
-		assert(NULL != buffer);
-	}
-	~data_unpacker() {delete[] buffer;}
+	piece_unpacker(int index, fl_type piece, fl_type piece_num) : _index(index), _piece(piece), _end(piece + piece_num), owned(false), buffer(NULL),
+		_offset(0), _data_len(0), _hash_len(0) {assert(piece_num > 0);}
 
-	virtual void reset() {_file = NULL; delete[] buffer; buffer = NULL; _data_len = 0;}
+	virtual void reset() {_piece = _end = 0; _data_len = _hash_len = 0; buffer = NULL;}
 	virtual bool parse_msg(size_t bytes_transferred, container_type& msg_can)
 	{
-		assert(_data_len >= (fl_type) bytes_transferred && bytes_transferred > 0);
-		_data_len -= bytes_transferred;
-		received_size += bytes_transferred;
+		assert(bytes_transferred > 0);
+		if (_data_len > 0)
+		{
+			assert(_data_len >= (fl_type) bytes_transferred);
+			if (owned)
+			{
+				hasher.update(buffer, bytes_transferred);
+				if (!write(buffer, bytes_transferred, _offset))
+					return false;
+			}
 
-		if (bytes_transferred != fwrite(buffer, 1, bytes_transferred, _file))
+			_offset += bytes_transferred;
+			_data_len -= bytes_transferred;
+			return true;
+		}
+
+		assert(_hash_len >= bytes_transferred);
+		_hash_len -= bytes_transferred;
+		if (_hash_len > 0)
+			return true;
+
+		if (owned)
 		{
-			printf("fwrite(" ST_ASIO_SF ") error!\n", bytes_transferred);
-			return false;
+			boost::uint64_t hash;
+			memcpy(&hash, hash_buffer, HASH_LEN);
+			file_ranges.end_piece(_index, _piece, hash == hasher.digest());
 		}
 
-		if (0 == _data_len)
+		if (++_piece == _end)
 			msg_can.emplace_back();
 
 		return true;
@@ -47,7 +69,18 @@ public:
 	virtual size_t completion_condition(const boost::system::error_code& ec, size_t bytes_transferred) {return ec ? 0 : boost::asio::detail::default_max_transfer_size;}
 	virtual buffer_type prepare_next_recv()
 	{
-		size_t buffer_len = _data_len > boost::asio::detail::default_max_transfer_size ? boost::asio::detail::default_max_transfer_size : (size_t) _data_len;
+		if (0 == _data_len && 0 == _hash_len && _piece < _end)
+			begin_piece();
+
+		size_t buffer_len;
+		if (_data_len > 0)
+			buffer = data_buffer(_offset, _data_len, buffer_len);
+		else
+		{
+			buffer = boost::next(hash_buffer, HASH_LEN - _hash_len);
+			buffer_len = _hash_len;
+		}
+
 #ifdef ST_ASIO_SCATTERED_RECV_BUFFER
 		return buffer_type(1, boost::asio::buffer(buffer, buffer_len));
 #else
@@ -55,11 +88,141 @@ public:
 #endif
 	}
 
+protected:
+	//where the next at most data_len bytes of the file (begin at offset) will be received into, return its length by buffer_len,
+	//content of stolen pieces (owned is false) will also be received into it, but will not be written.
+	virtual char* data_buffer(fl_type offset, fl_type data_len, size_t& buffer_len) = 0;
+	virtual bool write(const char* data, size_t len, fl_type offset) = 0;
+
+private:
+	void begin_piece()
+	{
+		owned = file_ranges.begin_piece(_index, _piece); //stolen pieces will be dropped
+		hasher.reset();
+		_offset = _piece * PIECE_SIZE;
+		_data_len = file_ranges.piece_length(_piece);
+		_hash_len = HASH_LEN;
+	}
+
+protected:
+	int _index;
+	fl_type _piece, _end; //[_piece, _end) have not been received
+	bool owned;
+	xxhash64 hasher;
+
+	char* buffer; //where the last receiving went into
+	char hash_buffer[HASH_LEN];
+	fl_type _offset, _data_len; //the rest of current piece's content
+	size_t _hash_len; //the rest of current piece's hash
+};
+
+class data_unpacker : public piece_unpacker
+{
+public:
+	data_unpacker(FILE* file, int index, fl_type piece, fl_type piece_num) : piece_unpacker(index, piece, piece_num), _file(file)
+	{
+		assert(NULL != _file);
+
+		data = new char[boost::asio::detail::default_max_transfer_size];
+		assert(NULL != data);
+	}
+	~data_unpacker() {delete[] data;}
+
+	virtual void reset() {_file = NULL; delete[] data; data = NULL; piece_unpacker::reset();}
+
+protected:
+	virtual char* data_buffer(fl_type offset, fl_type data_len, size_t& buffer_len)
+	{
+		buffer_len = data_len > boost::asio::detail::default_max_transfer_size ? boost::asio::detail::default_max_transfer_size : (size_t) data_len;
+		return data;
+	}
+
+	virtual bool write(const char* data, size_t len, fl_type offset)
+	{
+		//every link writes its own position, no shared file position, no stdio locking
+#ifdef _MSC_VER
+		if (0 != fseeko(_file, offset, SEEK_SET) || len != fwrite(data, 1, len, _file))
+#else
+		if ((ssize_t) len != pwrite(fileno(_file), data, len, offset))
+#endif
+		{
+			printf("write(" ST_ASIO_SF ") error!\n", len);
+			return false;
+		}
+
+		return true;
+	}
+
 protected:
 	FILE* _file;
-	char* buffer;
+	char* data;
+};
+
+#ifdef ST_ASIO_MAPPED_FILE_RECV
+#define MAPPED_RECV_SIZE	(1024 * 1024) //how many bytes can be received by one async_read at most, see mapped_data_unpacker::data_buffer
 
-	fl_type _data_len;
+//pre-size the file before mapping it, otherwise, accessing mapped pages beyond the end of the file will raise SIGBUS.
+//fallocate also reserves disk blocks for the whole file, which means less fragmentation and no ENOSPC during receiving.
+//all links invoke this function (with the same length), it's harmless because neither of them shrinks the file.
+inline bool resize_file(FILE* file, fl_type length)
+{
+#ifdef __linux__
+	if (0 == fallocate(fileno(file), 0, 0, length))
+		return true;
+#endif
+	return 0 == ftruncate(fileno(file), length); //fallocate is not supported
+}
+
+//receive file content into the mapped pages of the file directly, no intermediate buffer, no copying and no stdio locking.
+//stolen pieces (see range_scheduler) are received into a separate buffer, because they may be being verified by the stealer.
+class mapped_data_unpacker : public piece_unpacker
+{
+public:
+	mapped_data_unpacker(FILE* file, int index, fl_type piece, fl_type piece_num, fl_type data_len) : piece_unpacker(index, piece, piece_num), drop_buffer(NULL)
+	{
+		assert(NULL != file);
+
+		fl_type offset = piece * PIECE_SIZE;
+		fl_type page_size = sysconf(_SC_PAGESIZE);
+		map_offset = offset / page_size * page_size; //must be a multiple of the page size
+		map_len = (size_t) (offset - map_offset + data_len);
+		addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), map_offset);
+		if (MAP_FAILED == addr)
+		{
+			printf("mmap(" ST_ASIO_SF ") error!\n", map_len);
+			addr = NULL;
+		}
+	}
+	~mapped_data_unpacker() {reset();}
+
+	bool mapped() const {return NULL != addr;}
+
+	virtual void reset() {if (NULL != addr) munmap(addr, map_len); addr = NULL; delete[] drop_buffer; drop_buffer = NULL; piece_unpacker::reset();}
+
+protected:
+	//return a part of the mapped range, then progress (and range stealing) will be updated in time.
+	virtual char* data_buffer(fl_type offset, fl_type data_len, size_t& buffer_len)
+	{
+		if (!owned)
+		{
+			if (NULL == drop_buffer)
+				drop_buffer = new char[boost::asio::detail::default_max_transfer_size];
+			buffer_len = data_len > boost::asio::detail::default_max_transfer_size ? boost::asio::detail::default_max_transfer_size : (size_t) data_len;
+			return drop_buffer;
+		}
+
+		buffer_len = data_len > MAPPED_RECV_SIZE ? MAPPED_RECV_SIZE : (size_t) data_len;
+		return boost::next((char*) addr, offset - map_offset);
+	}
+
+	virtual bool write(const char* data, size_t len, fl_type offset) {return true;} //content already been in the file
+
+protected:
+	void* addr;
+	fl_type map_offset;
+	size_t map_len;
+	char* drop_buffer;
 };
+#endif
 
 #endif //UNPACKER_H_
@@ -2,6 +2,8 @@
 #define COMMON_H_
 
 #include <stdio.h>
+#include <string.h>
+#include <boost/cstdint.hpp>
 
 #ifdef _MSC_VER
 #define fseeko _fseeki64
@@ -14,6 +16,8 @@
 #define ORDER_LEN	sizeof(char)
 #define OFFSET_LEN	sizeof(fl_type)
 #define DATA_LEN	OFFSET_LEN
+#define PIECE_SIZE	(1024 * 1024) //see order 4
+#define HASH_LEN	sizeof(boost::uint64_t)
 
 /*
 protocol:
@@ -25,7 +29,9 @@ if head equal to:
 	return: same head + file length(8 bytes)
 1: body is file offset(8 bytes) + data length(8 bytes)
 	request the file content, client->server->client
-	return: file content(no-protocol), repeat until all data requested by client been sent(client only need to request one time)
+	return: file content(no-protocol), repeat until all data requested by client been sent(client only need to request one time per range)
+	a client can request many ranges of the file (even before the previous ones been received), the server sends them in order,
+	the file will be closed when the client requests another file or the link is broken.
 2: body is talk content
 	talk, client->server. please note that server cannot talk to client, this is because server never knows whether
 	it is going to transmit a file or not.
@@ -33,8 +39,108 @@ if head equal to:
 3: body is object id(8 bytes)
 	change file server's object ids, demonstrate how to use macro ST_ASIO_RESTORE_OBJECT.
 	return: n/a
+4: body is piece index(8 bytes) + piece number(8 bytes)
+	request pieces with their hashes, client->server->client. the file is cut into pieces with PIECE_SIZE bytes (except the last one).
+	return: for each piece, piece content(no-protocol) + hash of the content(HASH_LEN bytes, see xxhash64)
+	like 1, many requests can be sent, and they are served in order.
+	a broken transmission can be resumed by only requesting the pieces which the client doesn't have or failed to verify,
+	so the server keeps no state for it, but the file on the server must not be changed before the transmission finished.
 */
 
+//XXH64 (seed 0), it is fast enough to verify pieces while receiving them, we implement it here to avoid the dependency on xxHash.
+//multiple-byte integers are read in the host's byte order, so both ends must have the same endianness (little-endian).
+class xxhash64
+{
+public:
+	xxhash64() {reset();}
+
+	void reset()
+	{
+		v[0] = P1 + P2; v[1] = P2; v[2] = 0; v[3] = 0 - P1;
+		total_len = 0;
+		mem_len = 0;
+	}
+
+	void update(const char* data, size_t len)
+	{
+		total_len += len;
+		if (mem_len + len < sizeof(mem))
+		{
+			memcpy(mem + mem_len, data, len);
+			mem_len += len;
+			return;
+		}
+
+		if (mem_len > 0)
+		{
+			size_t fill_len = sizeof(mem) - mem_len;
+			memcpy(mem + mem_len, data, fill_len);
+			data += fill_len;
+			len -= fill_len;
+			stripe(mem);
+			mem_len = 0;
+		}
+
+		for (; len >= sizeof(mem); data += sizeof(mem), len -= sizeof(mem))
+			stripe(data);
+
+		memcpy(mem, data, len);
+		mem_len = len;
+	}
+
+	boost::uint64_t digest() const
+	{
+		boost::uint64_t h;
+		if (total_len >= sizeof(mem))
+		{
+			h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+			for (int i = 0; i < 4; ++i)
+				h = (h ^ round(0, v[i])) * P1 + P4;
+		}
+		else
+			h = P5;
+		h += total_len;
+
+		const char* p = mem;
+		const char* end = mem + mem_len;
+		for (; p + 8 <= end; p += 8)
+			h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+		if (p + 4 <= end)
+		{
+			h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+			p += 4;
+		}
+		for (; p < end; ++p)
+			h = rotl(h ^ ((unsigned char) *p * P5), 11) * P1;
+
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	static boost::uint64_t hash(const char* data, size_t len) {xxhash64 h; h.update(data, len); return h.digest();}
+
+private:
+	static const boost::uint64_t P1 = 0x9E3779B185EBCA87ULL, P2 = 0xC2B2AE3D27D4EB4FULL, P3 = 0x165667B19E3779F9ULL;
+	static const boost::uint64_t P4 = 0x85EBCA77C2B2AE63ULL, P5 = 0x27D4EB2F165667C5ULL;
+
+	static boost::uint64_t rotl(boost::uint64_t x, int r) {return (x << r) | (x >> (64 - r));}
+	static boost::uint64_t round(boost::uint64_t acc, boost::uint64_t input) {return rotl(acc + input * P2, 31) * P1;}
+	static boost::uint64_t read64(const char* p) {boost::uint64_t x; memcpy(&x, p, sizeof(x)); return x;}
+	static boost::uint64_t read32(const char* p) {boost::uint32_t x; memcpy(&x, p, sizeof(x)); return x;}
+
+	void stripe(const char* p) {for (int i = 0; i < 4; ++i, p += 8) v[i] = round(v[i], read64(p));}
+
+private:
+	boost::uint64_t v[4];
+	boost::uint64_t total_len;
+	char mem[32];
+	size_t mem_len;
+};
+
 class base_socket
 {
 public:
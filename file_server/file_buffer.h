@@ -6,17 +6,63 @@ using namespace st_asio_wrapper;
 
 #include "common.h"
 
-class file_buffer : public i_buffer
+#ifndef _MSC_VER
+#include <fcntl.h>
+#endif
+#ifdef ST_ASIO_ZERO_COPY_SEND
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define CHUNK_SIZE			(512 * 1024) //bigger chunks mean less thread switching between service threads and disk I/O threads
+#define READ_AHEAD_NUM		2 //how many chunks one transmission can have, one is being sent, others are being read or waiting for sending
+#define READ_AHEAD_SIZE		(4 * 1024 * 1024) //see file_range
+#define DISK_IO_THREAD_NUM	4
+
+//file reading (or hashing with ST_ASIO_ZERO_COPY_SEND) will be done in these threads rather than in service threads, then a slow disk
+//will not stall other sockets which are served by the same service thread.
+class disk_io_pool : public boost::noncopyable
 {
 public:
-	file_buffer(FILE* file, fl_type data_len) : _file(file), _data_len(data_len)
+#if BOOST_ASIO_VERSION >= 101100
+	typedef boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_type;
+	disk_io_pool(size_t thread_num) : work(new work_type(io_context_.get_executor())) {start(thread_num);}
+#else
+	typedef boost::asio::io_service::work work_type;
+	disk_io_pool(size_t thread_num) : work(new work_type(io_context_)) {start(thread_num);}
+#endif
+	~disk_io_pool() {stop();}
+
+	//finish all pending reading and then end all disk I/O threads
+	void stop() {work.reset(); threads.join_all();}
+
+#if BOOST_ASIO_VERSION >= 101100
+	void post(const boost::function<void()>& handler) {boost::asio::post(io_context_, handler);}
+#else
+	void post(const boost::function<void()>& handler) {io_context_.post(handler);}
+#endif
+
+private:
+	void start(size_t thread_num)
 	{
-		assert(NULL != _file);
+		for (size_t i = 0; i < thread_num; ++i)
+			threads.create_thread(boost::bind(&boost::asio::io_context::run, &io_context_));
+	}
 
-		buffer = new char[boost::asio::detail::default_max_transfer_size];
-		assert(NULL != buffer);
+private:
+	boost::asio::io_context io_context_;
+	boost::scoped_ptr<work_type> work;
+	boost::thread_group threads;
+};
 
-		read();
+//a chunk of the file, it's read in disk I/O threads, and recycled during one transmission.
+class file_buffer : public i_buffer
+{
+public:
+	file_buffer() : buffer_len(0)
+	{
+		buffer = new char[CHUNK_SIZE + HASH_LEN]; //the hash of a piece follows the last chunk of it, see order 4
+		assert(NULL != buffer);
 	}
 	~file_buffer() {delete[] buffer;}
 
@@ -25,28 +71,85 @@ public:
 	virtual size_t size() const {return buffer_len;}
 	virtual const char* data() const {return buffer;}
 
-	void read()
+	static size_t capacity() {return CHUNK_SIZE;}
+	bool read(FILE* file, fl_type offset, size_t len)
 	{
-		if (0 == _data_len)
-			buffer_len = 0;
-		else
-		{
-			buffer_len = _data_len > boost::asio::detail::default_max_transfer_size ? boost::asio::detail::default_max_transfer_size : (size_t) _data_len;
-			_data_len -= buffer_len;
-			if (buffer_len != fread(buffer, 1, buffer_len, _file))
-			{
-				printf("fread(" ST_ASIO_SF ") error!\n", buffer_len);
-				buffer_len = 0;
-			}
-		}
+		assert(NULL != file && len <= capacity());
+
+		buffer_len = 0 == fseeko(file, offset, SEEK_SET) ? fread(buffer, 1, len, file) : 0;
+		if (len == buffer_len)
+			return true;
+
+		printf("fread(" ST_ASIO_SF ") error!\n", len);
+		buffer_len = 0;
+		return false;
 	}
+	void append_hash(boost::uint64_t hash) {assert(buffer_len <= capacity()); memcpy(boost::next(buffer, buffer_len), &hash, HASH_LEN); buffer_len += HASH_LEN;}
 
 protected:
-	FILE* _file;
 	char* buffer;
 	size_t buffer_len;
+};
 
-	fl_type _data_len;
+#ifdef ST_ASIO_ZERO_COPY_SEND
+//file content will be sent by tcp::socket_base via sendfile(2) directly (or pread if sendfile is not available),
+//which means the whole range can be sent as one message, and we don't have to read the file in on_msg_send any more.
+class file_range : public i_buffer, public i_file_source
+{
+public:
+	file_range(FILE* file, fl_type offset, fl_type data_len) : _fd(fileno(file)), _offset(offset), _left(data_len), _data_len(data_len), _advised(offset)
+		{assert(NULL != file); read_ahead();}
+
+public:
+	virtual bool empty() const {return 0 == _data_len;}
+	virtual size_t size() const {return (size_t) _data_len;}
+	virtual const char* data() const {return NULL;}
+
+	virtual int fd() const {return _fd;}
+	virtual boost::int64_t offset() const {return _offset;}
+	virtual boost::int64_t left() const {return _left;}
+	virtual void consume(size_t len) {assert((fl_type) len <= _left); _offset += len; _left -= len; read_ahead();}
+
+	//sendfile never copies the content into user space, so we map it for hashing (no copying either, in disk I/O threads), it will be
+	//in the page cache then, and sendfile doesn't have to read the disk again.
+	static bool hash(FILE* file, fl_type offset, fl_type data_len, boost::uint64_t& digest)
+	{
+		fl_type page_size = sysconf(_SC_PAGESIZE);
+		fl_type map_offset = offset / page_size * page_size; //must be a multiple of the page size
+		size_t map_len = (size_t) (offset - map_offset + data_len);
+		void* addr = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fileno(file), map_offset);
+		if (MAP_FAILED == addr)
+		{
+			printf("mmap(" ST_ASIO_SF ") error!\n", map_len);
+			return false;
+		}
+
+		digest = xxhash64::hash(boost::next((const char*) addr, offset - map_offset), (size_t) data_len);
+		munmap(addr, map_len);
+		return true;
+	}
+
+protected:
+	//ask the kernel to read the next READ_AHEAD_SIZE bytes in the background before sendfile needs them, then sendfile
+	//will seldom block service threads for disk reading.
+	void read_ahead()
+	{
+#ifdef POSIX_FADV_WILLNEED
+		fl_type end = _offset + _left;
+		if (_advised < end && _advised - _offset < READ_AHEAD_SIZE)
+		{
+			fl_type len = std::min(end - _advised, (fl_type) (2 * READ_AHEAD_SIZE) - (_advised - _offset));
+			posix_fadvise(_fd, _advised, len, POSIX_FADV_WILLNEED);
+			_advised += len;
+		}
+#endif
+	}
+
+protected:
+	int _fd;
+	fl_type _offset, _left, _data_len;
+	fl_type _advised; //where read-ahead ends
 };
+#endif
 
 #endif //FILE_BUFFER_H_
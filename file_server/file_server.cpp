@@ -6,11 +6,13 @@
 #define ST_ASIO_RESTORE_OBJECT
 #define ST_ASIO_ENHANCED_STABILITY
 #define ST_ASIO_WANT_MSG_SEND_NOTIFY
-#define ST_ASIO_INPUT_QUEUE non_lock_queue
-//file_server / file_client is a responsive system, before file_server send each message (except talking message,
-//but file_server only receive talking message, not send talking message proactively), the previous message has been
-//sent to file_client, so sending buffer will always be empty, which means we will never operate sending buffer concurrently,
-//so need no locks.
+#ifndef _MSC_VER
+#define ST_ASIO_ZERO_COPY_SEND //send file content via sendfile(2), see file_range for more details.
+#endif
+//#define ST_ASIO_INPUT_QUEUE non_lock_queue
+//we cannot use non_lock_queue, because file_client may request the next range before the previous range been sent out (from
+//file_server's point of view), and file chunks are sent when they have been read (see file_socket::on_chunk_read), both may
+//happen while the sending logic is still working in another service thread.
 #define ST_ASIO_DEFAULT_PACKER	replaceable_packer<>
 #define ST_ASIO_RECV_BUFFER_TYPE std::vector<boost::asio::mutable_buffer> //scatter-gather buffer, it's very useful under certain situations (for example, ring buffer).
 #define ST_ASIO_SCATTERED_RECV_BUFFER //used by unpackers, not belongs to st_asio_wrapper
@@ -18,12 +20,19 @@
 
 #include "file_socket.h"
 
+#ifdef ST_ASIO_ZERO_COPY_SEND
+#include <signal.h>
+#endif
+
 #define QUIT_COMMAND	"quit"
 #define RESTART_COMMAND	"restart"
 #define LIST_ALL_CLIENT	"list_all_client"
 
 int main(int argc, const char* argv[])
 {
+#ifdef ST_ASIO_ZERO_COPY_SEND
+	signal(SIGPIPE, SIG_IGN); //sendfile raises SIGPIPE if the peer closed the connection, see ST_ASIO_ZERO_COPY_SEND
+#endif
 	puts("this is a file transfer server.");
 	printf("usage: %s [<port=%d> [ip=0.0.0.0]]\n", argv[0], ST_ASIO_SERVER_PORT);
 	if (argc >= 2 && (0 == strcmp(argv[1], "--help") || 0 == strcmp(argv[1], "-h")))
@@ -54,6 +63,7 @@ int main(int argc, const char* argv[])
 		else if (LIST_ALL_CLIENT == str)
 			file_server_.list_all_object();
 	}
+	disk_io.stop(); //before file_socket and service_pump been freed, because reading chunks and hashing ranges may refer them
 
 	return 0;
 }
@@ -4,11 +4,13 @@
 #define ST_ASIO_RESTORE_OBJECT
 #define ST_ASIO_ENHANCED_STABILITY
 #define ST_ASIO_WANT_MSG_SEND_NOTIFY
-#define ST_ASIO_INPUT_QUEUE non_lock_queue
-//file_server / file_client is a responsive system, before file_server send each message (except talking message,
-//but file_server only receive talking message, not send talking message proactively), the previous message has been
-//sent to file_client, so sending buffer will always be empty, which means we will never operate sending buffer concurrently,
-//so need no locks.
+#ifndef _MSC_VER
+#define ST_ASIO_ZERO_COPY_SEND //send file content via sendfile(2), see file_range for more details.
+#endif
+//#define ST_ASIO_INPUT_QUEUE non_lock_queue
+//we cannot use non_lock_queue, because file_client may request the next range before the previous range been sent out (from
+//file_server's point of view), and file chunks are sent when they have been read (see file_socket::on_chunk_read), both may
+//happen while the sending logic is still working in another service thread.
 #define ST_ASIO_DEFAULT_PACKER	replaceable_packer<>
 #define ST_ASIO_RECV_BUFFER_TYPE std::vector<boost::asio::mutable_buffer> //scatter-gather buffer, it's very useful under certain situations (for example, ring buffer).
 #define ST_ASIO_SCATTERED_RECV_BUFFER //used by unpackers, not belongs to st_asio_wrapper
@@ -16,7 +18,13 @@
 
 #include "file_socket.h"
 
-file_socket::file_socket(i_server& server_) : server_socket(server_) {}
+disk_io_pool disk_io(DISK_IO_THREAD_NUM);
+
+#ifdef ST_ASIO_ZERO_COPY_SEND
+file_socket::file_socket(i_server& server_) : server_socket(server_), file_size(0), range_num(0) {}
+#else
+file_socket::file_socket(i_server& server_) : server_socket(server_), file_size(0), reading(false), sending_chunk(false) {}
+#endif
 file_socket::~file_socket() {trans_end();}
 
 void file_socket::reset() {trans_end(); server_socket::reset();}
@@ -39,18 +47,21 @@ bool file_socket::on_msg_handle(out_msg_type& msg) {handle_msg(msg); return true
 #ifdef ST_ASIO_WANT_MSG_SEND_NOTIFY
 void file_socket::on_msg_send(in_msg_type& msg)
 {
-	BOOST_AUTO(buffer, dynamic_cast<file_buffer*>(msg.raw_buffer()));
-	if (NULL != buffer)
+#ifdef ST_ASIO_ZERO_COPY_SEND
+	if (NULL != dynamic_cast<file_range*>(msg.raw_buffer())) //the whole range has been sent
+		--range_num; //may be invoked within direct_send_msg (with range_mutex locked), see on_range_hashed
+#else
+	BOOST_AUTO(chunk, dynamic_cast<file_buffer*>(msg.raw_buffer()));
+	if (NULL != chunk)
 	{
-		buffer->read();
-		if (buffer->empty())
-			trans_end();
-		else
-			direct_send_msg(msg, true);
+		msg.raw_buffer(NULL); //take the chunk back for recycling
+		on_chunk_sent(chunk);
 	}
+#endif
 }
 #endif
 
+//file will not be closed after a range been sent, because file_client may request more ranges.
 void file_socket::trans_end()
 {
 	state = TRANS_IDLE;
@@ -59,8 +70,187 @@ void file_socket::trans_end()
 		fclose(file);
 		file = NULL;
 	}
+
+#ifdef ST_ASIO_ZERO_COPY_SEND
+	//no ranges are being hashed now (in disk I/O threads)
+	ranges.clear();
+#else
+	//no chunks are being read now (in disk I/O threads)
+	for (BOOST_AUTO(iter, free_chunks.begin()); iter != free_chunks.end(); ++iter)
+		delete *iter;
+	for (BOOST_AUTO(iter, ready_chunks.begin()); iter != ready_chunks.end(); ++iter)
+		delete *iter;
+	free_chunks.clear();
+	ready_chunks.clear();
+	ranges.clear();
+	reading = sending_chunk = false;
+#endif
+}
+
+#ifdef ST_ASIO_ZERO_COPY_SEND
+bool file_socket::is_busy() {boost::lock_guard<boost::mutex> lock(range_mutex); return !ranges.empty() || range_num > 0;}
+
+void file_socket::send_range(fl_type offset, fl_type length, bool hashed)
+{
+	boost::lock_guard<boost::mutex> lock(range_mutex);
+	ranges.push_back(range_info(offset, length, hashed));
+	send_next_range();
+}
+
+void file_socket::hash_range(fl_type offset, fl_type length)
+{
+	boost::uint64_t hash = 0;
+	bool succ = file_range::hash(file, offset, length, hash);
+
+	post(boost::bind(&file_socket::on_range_hashed, this, hash, succ));
+}
+
+//the hash follows the range
+void file_socket::on_range_hashed(boost::uint64_t hash, bool succ)
+{
+	{
+		boost::lock_guard<boost::mutex> lock(range_mutex);
+		if (ranges.empty() || !ranges.front().begun) //the transmission has ended
+			return;
+		else if (succ)
+		{
+			range_info& range = ranges.front();
+			++range_num;
+			in_msg_type msg(new file_range(file, range.offset, range.length));
+			direct_send_msg(msg, true);
+			send_native_msg((const char*) &hash, HASH_LEN, true);
+
+			ranges.pop_front();
+			send_next_range();
+		}
+		else
+			ranges.clear();
+	}
+
+	if (!succ)
+		force_shutdown(); //let the client know that the range can not be sent
 }
 
+void file_socket::send_next_range()
+{
+	while (!ranges.empty() && !ranges.front().begun)
+	{
+		range_info& range = ranges.front();
+		if (range.hashed)
+		{
+			range.begun = true;
+			//hold this socket until the range been hashed, then object_pool will not free or reuse it
+			disk_io.post(boost::bind(&file_socket::hash_range, boost::static_pointer_cast<file_socket>(shared_from_this()), range.offset, range.length));
+			return;
+		}
+
+		++range_num;
+		in_msg_type msg(new file_range(file, range.offset, range.length));
+		direct_send_msg(msg, true);
+		ranges.pop_front();
+	}
+}
+#else
+bool file_socket::is_busy() {boost::lock_guard<boost::mutex> lock(chunk_mutex); return !ranges.empty() || reading || sending_chunk || !ready_chunks.empty();}
+
+void file_socket::send_range(fl_type offset, fl_type length, bool hashed)
+{
+	boost::lock_guard<boost::mutex> lock(chunk_mutex);
+	ranges.push_back(range_info(offset, length, hashed));
+	read_next_chunk();
+}
+
+void file_socket::read_chunk(file_buffer* chunk, fl_type offset, size_t len, int hash_op)
+{
+	bool succ = chunk->read(file, offset, len);
+	if (succ && HASH_NONE != hash_op)
+	{
+		if (hash_op & HASH_RESET)
+			hasher.reset();
+		hasher.update(chunk->data(), len);
+		if (hash_op & HASH_APPEND)
+			chunk->append_hash(hasher.digest());
+	}
+
+	post(boost::bind(&file_socket::on_chunk_read, this, chunk, succ));
+}
+
+void file_socket::on_chunk_read(file_buffer* chunk, bool succ)
+{
+	{
+		boost::lock_guard<boost::mutex> lock(chunk_mutex);
+		reading = false;
+		if (succ)
+			ready_chunks.push_back(chunk);
+		else
+		{
+			free_chunks.push_back(chunk);
+			ranges.clear();
+		}
+
+		send_next_chunk();
+		read_next_chunk();
+	}
+
+	if (!succ)
+		force_shutdown(); //let the client know that the range can not be sent
+}
+
+void file_socket::on_chunk_sent(file_buffer* chunk)
+{
+	boost::lock_guard<boost::mutex> lock(chunk_mutex);
+	sending_chunk = false;
+	free_chunks.push_back(chunk);
+
+	send_next_chunk();
+	read_next_chunk();
+}
+
+void file_socket::read_next_chunk()
+{
+	if (reading || ranges.empty() || free_chunks.empty())
+		return;
+
+	file_buffer* chunk = free_chunks.front();
+	free_chunks.pop_front();
+
+	range_info& range = ranges.front();
+	fl_type offset = range.offset;
+	size_t len = range.length > (fl_type) file_buffer::capacity() ? file_buffer::capacity() : (size_t) range.length;
+	range.offset += len;
+	range.length -= len;
+
+	int hash_op = HASH_NONE;
+	if (range.hashed)
+	{
+		hash_op = HASH_UPDATE;
+		if (!range.begun)
+			hash_op |= HASH_RESET;
+		if (0 == range.length)
+			hash_op |= HASH_APPEND;
+	}
+	range.begun = true;
+
+	if (0 == range.length)
+		ranges.pop_front();
+	reading = true;
+
+	//hold this socket until the chunk been read, then object_pool will not free or reuse it
+	disk_io.post(boost::bind(&file_socket::read_chunk, boost::static_pointer_cast<file_socket>(shared_from_this()), chunk, offset, len, hash_op));
+}
+
+void file_socket::send_next_chunk()
+{
+	if (sending_chunk || ready_chunks.empty())
+		return;
+
+	in_msg_type msg(ready_chunks.front());
+	ready_chunks.pop_front();
+	sending_chunk = true;
+	direct_send_msg(msg, true);
+}
+#endif
+
 void file_socket::handle_msg(out_msg_ctype& msg)
 {
 	if (msg.size() <= ORDER_LEN)
@@ -72,7 +262,7 @@ void file_socket::handle_msg(out_msg_ctype& msg)
 	switch (*msg.data())
 	{
 	case 0:
-		if (TRANS_IDLE == state)
+		if (!is_busy())
 		{
 			trans_end();
 
@@ -83,9 +273,13 @@ void file_socket::handle_msg(out_msg_ctype& msg)
 			if (NULL != file)
 			{
 				fseeko(file, 0, SEEK_END);
-				fl_type length = ftello(file);
-				memcpy(boost::next(buffer, ORDER_LEN), &length, DATA_LEN);
+				file_size = ftello(file);
+				memcpy(boost::next(buffer, ORDER_LEN), &file_size, DATA_LEN);
 				state = TRANS_PREPARE;
+#ifndef ST_ASIO_ZERO_COPY_SEND
+				for (int i = 0; i < READ_AHEAD_NUM; ++i)
+					free_chunks.push_back(new file_buffer());
+#endif
 			}
 			else
 			{
@@ -97,19 +291,15 @@ void file_socket::handle_msg(out_msg_ctype& msg)
 		}
 		break;
 	case 1:
-		if (TRANS_PREPARE == state && NULL != file && ORDER_LEN + OFFSET_LEN + DATA_LEN == msg.size())
+		//ranges are sent in the order they were requested, the next range can be requested before the previous one been sent out.
+		if (TRANS_IDLE != state && NULL != file && ORDER_LEN + OFFSET_LEN + DATA_LEN == msg.size())
 		{
 			fl_type offset;
 			memcpy(&offset, boost::next(msg.data(), ORDER_LEN), OFFSET_LEN);
 			fl_type length;
 			memcpy(&length, boost::next(msg.data(), ORDER_LEN + OFFSET_LEN), DATA_LEN);
-			if (offset >= 0 && length > 0 && offset + length <= ftello(file))
-			{
-				state = TRANS_BUSY;
-				fseeko(file, offset, SEEK_SET);
-				in_msg_type msg(new file_buffer(file, length));
-				direct_send_msg(msg, true);
-			}
+			if (offset >= 0 && length > 0 && offset <= file_size && length <= file_size - offset) //overflow safe
+				send_range(offset, length, false);
 		}
 		break;
 	case 2:
@@ -122,6 +312,21 @@ void file_socket::handle_msg(out_msg_ctype& msg)
 			memcpy(&id, boost::next(msg.data(), ORDER_LEN), sizeof(boost::uint_fast64_t));
 			server.restore_socket(ST_THIS shared_from_this(), id);
 		}
+		break;
+	case 4:
+		//every piece is sent as a range, followed by its hash.
+		if (TRANS_IDLE != state && NULL != file && ORDER_LEN + OFFSET_LEN + DATA_LEN == msg.size())
+		{
+			fl_type piece;
+			memcpy(&piece, boost::next(msg.data(), ORDER_LEN), OFFSET_LEN);
+			fl_type piece_num;
+			memcpy(&piece_num, boost::next(msg.data(), ORDER_LEN + OFFSET_LEN), DATA_LEN);
+			fl_type total = (file_size + PIECE_SIZE - 1) / PIECE_SIZE;
+			if (piece >= 0 && piece_num > 0 && piece <= total && piece_num <= total - piece) //overflow safe
+				for (fl_type offset = piece * PIECE_SIZE; piece_num > 0; --piece_num, offset += PIECE_SIZE)
+					send_range(offset, std::min((fl_type) PIECE_SIZE, file_size - offset), true);
+		}
+		break;
 	default:
 		break;
 	}
@@ -8,6 +8,8 @@ using namespace st_asio_wrapper::ext::tcp;
 
 #include "file_buffer.h"
 
+extern disk_io_pool disk_io;
+
 class file_socket : public base_socket, public server_socket
 {
 public:
@@ -36,7 +38,47 @@ protected:
 
 private:
 	void trans_end();
+	bool is_busy(); //some ranges have not been sent
 	void handle_msg(out_msg_ctype& msg);
+	void send_range(fl_type offset, fl_type length, bool hashed);
+
+#ifdef ST_ASIO_ZERO_COPY_SEND
+	//a hashed range will not be sent until its hash been calculated (in disk I/O threads), ranges are sent in the order they were requested.
+	void hash_range(fl_type offset, fl_type length); //in disk I/O threads
+	void on_range_hashed(boost::uint64_t hash, bool succ); //posted back to service threads
+	void send_next_range(); //must be invoked with range_mutex locked
+#else
+	//how to hash a chunk, a piece (order 4) may be read as several chunks
+	enum {HASH_NONE = 0, HASH_UPDATE = 1, HASH_RESET = 2, HASH_APPEND = 4};
+	//read-ahead, while a chunk is being sent, the next chunk is being read in disk I/O threads.
+	void read_chunk(file_buffer* chunk, fl_type offset, size_t len, int hash_op); //in disk I/O threads
+	void on_chunk_read(file_buffer* chunk, bool succ); //posted back to service threads
+	void on_chunk_sent(file_buffer* chunk);
+	//following two functions must be invoked with chunk_mutex locked
+	void read_next_chunk();
+	void send_next_chunk();
+#endif
+
+private:
+	fl_type file_size;
+	struct range_info
+	{
+		fl_type offset, length;
+		bool hashed, begun; //begun means some chunks of this range have been read (or it's being hashed with ST_ASIO_ZERO_COPY_SEND)
+		range_info(fl_type offset_, fl_type length_, bool hashed_) : offset(offset_), length(length_), hashed(hashed_), begun(false) {}
+	};
+
+#ifdef ST_ASIO_ZERO_COPY_SEND
+	boost::mutex range_mutex;
+	std::list<range_info> ranges; //requested but not been handed to tcp::socket_base
+	atomic_size_t range_num; //how many ranges have been handed to tcp::socket_base but not been sent
+#else
+	boost::mutex chunk_mutex;
+	std::list<file_buffer*> free_chunks, ready_chunks;
+	std::list<range_info> ranges; //requested but not been read
+	bool reading, sending_chunk;
+	xxhash64 hasher; //only used in disk I/O threads, and only one chunk can be read at any time
+#endif
 };
 
 #endif //#ifndef FILE_SOCKET_H_
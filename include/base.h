@@ -20,6 +20,7 @@
 #include <string>
 #include <sstream>
 
+#include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
@@ -62,6 +63,14 @@ public:
 	T exchange(T value, boost::memory_order) {boost::lock_guard<boost::mutex> lock(data_mutex); T pre_data = data; data = value; return pre_data;}
 	T fetch_add(T value, boost::memory_order) {boost::lock_guard<boost::mutex> lock(data_mutex); T pre_data = data; data += value; return pre_data;}
 	T fetch_sub(T value, boost::memory_order) {boost::lock_guard<boost::mutex> lock(data_mutex); T pre_data = data; data -= value; return pre_data;}
+	bool compare_exchange_weak(T& expected, T desired, boost::memory_order, boost::memory_order)
+	{
+		boost::lock_guard<boost::mutex> lock(data_mutex);
+		if (data == expected) {data = desired; return true;}
+		expected = data; return false;
+	}
+	bool compare_exchange_strong(T& expected, T desired, boost::memory_order success, boost::memory_order failure)
+		{return compare_exchange_weak(expected, desired, success, failure);}
 	void store(T value, boost::memory_order) {boost::lock_guard<boost::mutex> lock(data_mutex); data = value;}
 	T load(boost::memory_order) const {return data;}
 
@@ -93,6 +102,30 @@ private:
 	atomic_type& atomic;
 };
 
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+//the number of started sockets (from start() to close()) which belong to an io_context, service_pump uses it to find out the least
+//loaded io_context, allocated but not started (or closed) sockets don't count, they don't generate any I/O.
+class io_context_load : public boost::asio::detail::service_base<io_context_load>
+{
+public:
+	io_context_load(boost::asio::io_context& io_context_) : boost::asio::detail::service_base<io_context_load>(io_context_), num(0) {}
+
+	void increase() {num.fetch_add(1, boost::memory_order_relaxed);}
+	void decrease() {num.fetch_sub(1, boost::memory_order_relaxed);}
+	size_t load() const {return num.load(boost::memory_order_relaxed);}
+
+private:
+#if BOOST_ASIO_VERSION >= 101100
+	virtual void shutdown() {}
+#else
+	virtual void shutdown_service() {}
+#endif
+
+private:
+	atomic_size_t num;
+};
+#endif
+
 class service_pump;
 class object;
 namespace tcp
@@ -102,6 +135,7 @@ namespace tcp
 	public:
 		virtual service_pump& get_service_pump() = 0;
 		virtual const service_pump& get_service_pump() const = 0;
+		virtual boost::asio::io_context& assign_io_context() = 0; //pick up an io_context for a new server socket
 		virtual bool del_socket(const boost::shared_ptr<object>& socket_ptr) = 0;
 		virtual bool restore_socket(const boost::shared_ptr<object>& socket_ptr, boost::uint_fast64_t id) = 0;
 	};
@@ -117,6 +151,20 @@ public:
 	virtual const char* data() const = 0;
 };
 
+//a message whose content is a range of a file, tcp::socket_base will send it via sendfile(2) rather than data() and size(),
+//so the content will never be copied into user space, see macro ST_ASIO_ZERO_COPY_SEND for more details.
+//the message must implement i_buffer too (size() returns the length of the whole range, data() will not be used).
+class i_file_source
+{
+public:
+	virtual ~i_file_source() {}
+
+	virtual int fd() const = 0;
+	virtual boost::int64_t offset() const = 0; //where the unsent content begins
+	virtual boost::int64_t left() const = 0; //how many bytes have not been sent
+	virtual void consume(size_t len) = 0; //len bytes have been sent
+};
+
 //convert '->' operation to '.' operation
 //user need to allocate object, and auto_buffer will free it
 template<typename T> class auto_buffer : public boost::noncopyable
@@ -302,6 +350,8 @@ struct statistic
 
 		recv_msg_sum = 0;
 		recv_byte_sum = 0;
+		dispatch_msg_sum = 0;
+		dispatch_batch_sum = 0;
 
 		last_send_time = 0;
 		last_recv_time = 0;
@@ -337,6 +387,8 @@ struct statistic
 
 		recv_msg_sum += other.recv_msg_sum;
 		recv_byte_sum += other.recv_byte_sum;
+		dispatch_msg_sum += other.dispatch_msg_sum;
+		dispatch_batch_sum += other.dispatch_batch_sum;
 		dispatch_dealy_sum += other.dispatch_dealy_sum;
 		recv_idle_sum += other.recv_idle_sum;
 #ifndef ST_ASIO_FORCE_TO_USE_MSG_RECV_BUFFER
@@ -362,6 +414,7 @@ struct statistic
 			<< "\nrecv corresponding statistic:\n"
 			<< "message sum: " << recv_msg_sum << std::endl
 			<< "size in bytes: " << recv_byte_sum << std::endl
+			<< "dispatch batch: " << dispatch_msg_sum << " / " << dispatch_batch_sum << std::endl
 			<< "dispatch delay: " << dispatch_dealy_sum.total_seconds() << "." << std::setw(tw) << dispatch_dealy_sum.fractional_seconds() << std::setw(0) << std::endl
 			<< "recv idle duration: " << recv_idle_sum.total_seconds() << "." << std::setw(tw) << recv_idle_sum.fractional_seconds() << std::setw(0) << std::endl
 #ifndef ST_ASIO_FORCE_TO_USE_MSG_RECV_BUFFER
@@ -375,7 +428,8 @@ struct statistic
 			<< "size in bytes: " << send_byte_sum << std::endl
 			<< "\nrecv corresponding statistic:\n"
 			<< "message sum: " << recv_msg_sum << std::endl
-			<< "size in bytes: " << recv_byte_sum;
+			<< "size in bytes: " << recv_byte_sum << std::endl
+			<< "dispatch batch: " << dispatch_msg_sum << " / " << dispatch_batch_sum;
 #endif
 		return s.str();
 	}
@@ -391,6 +445,8 @@ struct statistic
 	//recv corresponding statistic
 	boost::uint_fast64_t recv_msg_sum; //msgs returned by i_unpacker::parse_msg
 	boost::uint_fast64_t recv_byte_sum; //msgs (in bytes) returned by i_unpacker::parse_msg
+	boost::uint_fast64_t dispatch_msg_sum; //msgs successfully handled by on_msg_handle
+	boost::uint_fast64_t dispatch_batch_sum; //how many times msg_handler been posted, dispatch_msg_sum / dispatch_batch_sum is the average batch size
 	stat_duration dispatch_dealy_sum; //from parse_msg(exclude msg unpacking) to on_msg_handle
 	stat_duration recv_idle_sum; //during this duration, socket suspended msg reception (receiving buffer overflow or doing congestion control)
 #ifndef ST_ASIO_FORCE_TO_USE_MSG_RECV_BUFFER
@@ -435,6 +491,42 @@ struct obj_with_begin_time : public T
 	typename statistic::stat_time begin_time;
 };
 
+//a buffer sequence which refers to buffers owned by others, asio copies buffer sequence along with the handler,
+//so use it to pass a (reusable) buffer array to async_write without any memory allocation.
+template<typename Buffer>
+class buffer_range
+{
+public:
+	typedef Buffer value_type;
+	typedef const Buffer* const_iterator;
+
+	buffer_range(const_iterator begin_, const_iterator end_) : _begin(begin_), _end(end_) {}
+
+	const_iterator begin() const {return _begin;}
+	const_iterator end() const {return _end;}
+
+private:
+	const_iterator _begin, _end;
+};
+
+//how tcp::socket_base sends a message, by default, a message is sent as one gather buffer (data() and size()),
+//specialize this template to send a message with more than one gather buffers (at most MAX_BUFFER_NUM), see ext::gather_buffer.
+template<typename T>
+struct msg_buffer_traits
+{
+	enum {MAX_BUFFER_NUM = 1};
+
+	static size_t buffer_num(const T& msg) {return 1;}
+	static boost::asio::const_buffer buffer(const T& msg, size_t index) {assert(0 == index); return boost::asio::const_buffer(msg.data(), msg.size());}
+};
+
+//whether a message is a file range (see i_file_source) or not, only replaceable messages (i_buffer based) can be file ranges.
+template<typename T> struct msg_file_traits {static i_file_source* file_source(const T& msg) {return NULL;}};
+template<> struct msg_file_traits<replaceable_buffer>
+	{static i_file_source* file_source(const replaceable_buffer& msg) {return dynamic_cast<i_file_source*>(msg.raw_buffer());}};
+template<> struct msg_file_traits<shared_buffer<i_buffer> >
+	{static i_file_source* file_source(const shared_buffer<i_buffer>& msg) {return dynamic_cast<i_file_source*>(msg.raw_buffer().get());}};
+
 //free functions, used to do something to any container(except map and multimap) optionally with any mutex
 template<typename _Can, typename _Mutex, typename _Predicate>
 void do_something_to_all(_Can& __can, _Mutex& __mutex, const _Predicate& __pred)
@@ -558,10 +650,35 @@ TCP_SEND_MSG_CALL_SWITCH(FUNNAME, size_t)
 bool FUNNAME(const char* const pstr[], const size_t len[], size_t num, bool can_overflow = false) {while (!SEND_FUNNAME(pstr, len, num, can_overflow)) SAFE_SEND_MSG_CHECK return true;} \
 TCP_SEND_MSG_CALL_SWITCH(FUNNAME, bool)
 
+//sockets are visited in the calling thread, for blocking sending functions (safe_send_msg and sync_send_msg), they wait for service threads
+//to send messages out, so they must not occupy service threads.
 #define TCP_BROADCAST_MSG(FUNNAME, SEND_FUNNAME) \
 void FUNNAME(const char* const pstr[], const size_t len[], size_t num, bool can_overflow = false) \
 	{ST_THIS do_something_to_all(boost::bind(&Socket::SEND_FUNNAME, _1, pstr, len, num, can_overflow));} \
 TCP_SEND_MSG_CALL_SWITCH(FUNNAME, void)
+
+//shards are visited by service threads in parallel (see object_pool::parallel_do_something_to_all), only for non-blocking sending functions.
+#define TCP_PARALLEL_BROADCAST_MSG(FUNNAME, SEND_FUNNAME) \
+void FUNNAME(const char* const pstr[], const size_t len[], size_t num, bool can_overflow = false) \
+	{ST_THIS parallel_do_something_to_all(boost::bind(&Socket::SEND_FUNNAME, _1, pstr, len, num, can_overflow));} \
+TCP_SEND_MSG_CALL_SWITCH(FUNNAME, void)
+
+//pack the message only once (with the first socket's packer, so all sockets must use the same protocol), then send it to all sockets via
+//direct_send_msg, the socket set is a snapshot (see object_pool::snapshot) and sockets are visited by service threads in parallel.
+//the packed message is copied into every socket's send buffer, so "pack once, then share" only holds for reference counted (immutable)
+//in_msg_type (for example, immutable_buffer with ext::immutable_packer, or gather_buffer with ext::gather_packer), with the default packer
+//(std::string), only packing is saved, the message is still copied for every socket.
+#define TCP_SHARED_BROADCAST_MSG(FUNNAME, NATIVE) \
+void FUNNAME(const char* const pstr[], const size_t len[], size_t num, bool can_overflow = false) \
+{ \
+	typename Pool::snapshot_type objects; \
+	ST_THIS snapshot(objects); \
+	typename Socket::in_msg_type msg; \
+	if (!objects.empty() && objects.front()->packer()->pack_msg(msg, pstr, len, num, NATIVE)) \
+		ST_THIS parallel_do_something_to_snapshot(objects, \
+			boost::bind((bool (Socket::*)(typename Socket::in_msg_ctype&, bool)) &Socket::direct_send_msg, _1, boost::cref(msg), can_overflow)); \
+} \
+TCP_SEND_MSG_CALL_SWITCH(FUNNAME, void)
 //TCP msg sending interface
 ///////////////////////////////////////////////////
 
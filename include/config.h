@@ -316,6 +316,33 @@
  * SPECIAL ATTENTION (incompatible with old editions):
  *
  * HIGHLIGHT:
+ * Add lock_free_queue (multiple producers, single consumer), it can be used as input queue to avoid lock contention
+ *  when many threads send messages via the same socket (needs boost-1.53 or higher).
+ * Add ring_unpacker, it never moves half-baked messages and provides real scatter-gather buffers (two buffers when the free space wraps around)
+ *  if macro ST_ASIO_SCATTERED_RECV_BUFFER been defined.
+ * Add slab_buffer and slab_unpacker, parsed messages refer to the reference-counted receiving slab directly (no memory allocation
+ *  nor replication per message), the slab will be freed after all messages which refer to it been destroyed.
+ * Support batch message delivery (socket::on_msgs), see macro ST_ASIO_BATCH_ON_MSG for more details.
+ * Support batch message dispatching (on_msg_handle), see macro ST_ASIO_MAX_DISPATCH_BATCH and ST_ASIO_DISPATCH_BATCH_DURATION for more details.
+ * Add dispatch_msg_sum and dispatch_batch_sum to statistic.
+ * Add a new container chunk_list, it can be used as the input and output container (see ST_ASIO_INPUT_CONTAINER and ST_ASIO_OUTPUT_CONTAINER).
+ * tcp::socket_base no longer allocates memory for every gather buffer and every message in sending, see macro ST_ASIO_MAX_SEND_BUF_NUM.
+ * Support send coalescing policy, see macro ST_ASIO_MAX_SEND_SIZE, ST_ASIO_MERGE_MSG_SIZE and ST_ASIO_SEND_LINGER for more details.
+ * Support per-socket handler memory, see macro ST_ASIO_HANDLER_MEMORY_SIZE for more details.
+ * Support counting async calls and notifying the end of the last async call, see macro ST_ASIO_ASYNC_CALL_COUNTER for more details.
+ * Support hierarchical timing wheel and compact timer storage in timer, see macro ST_ASIO_TIMER_WHEEL_TICK and ST_ASIO_COMPACT_TIMER for more details.
+ * Support io_context pool (one io_context per service thread) in service_pump, see macro ST_ASIO_IO_CONTEXT_POOL for more details.
+ * Support binding service threads to CPUs (NUMA aware), see macro ST_ASIO_THREAD_AFFINITY and ST_ASIO_LOCAL_UNPACKER for more details.
+ * Support multiple acceptors (SO_REUSEPORT) in server_base, see macro ST_ASIO_ACCEPTOR_NUM for more details.
+ * Support adaptive accept concurrency and batch accepting, see macro ST_ASIO_MAX_ASYNC_ACCEPT_NUM and ST_ASIO_ACCEPT_BATCH for more details.
+ * Support sharded object_pool (lock striping by object id) and parallel broadcasting, see macro ST_ASIO_OBJECT_POOL_SHARD_NUM for more details.
+ * object_pool indexes invalid objects by id and keeps reusable ones in a free list, see macro ST_ASIO_SWEEP_OBJECT_INTERVAL for more details.
+ * Support packing once and sharing the packed message in broadcasting, see TCP_SHARED_BROADCAST_MSG for more details.
+ * Add immutable_buffer (an immutable, reference-counted and cache line aligned buffer) and immutable_packer, see ST_ASIO_CACHE_LINE_SIZE for more details.
+ * Add buffer_pool (size-classed thread-local memory pool), pooled_buffer and pooled_packer, see ST_ASIO_MAX_POOLED_BUFFER_NUM for more details.
+ * Add gather_buffer and gather_packer, the header and the body of a message are sent as separate gather buffers, see msg_buffer_traits and
+ *  ST_ASIO_MAX_GATHER_FRAGMENT_NUM for more details.
+ * Support sending file ranges via sendfile(2) in tcp::socket_base (zero copy), see i_file_source and macro ST_ASIO_ZERO_COPY_SEND for more details.
  *
  * FIX:
  * Support unmovable buffers (for example: a very short std::string).
@@ -324,6 +351,10 @@
  * Avoid division by zero error in demo file_client.
  *
  * ENHANCEMENTS:
+ * Demo file_server reads files in dedicated disk I/O threads with double buffering, or asks the kernel to read ahead if sendfile is used.
+ * Demo file_client cuts the file into small ranges and hands them out on demand, idle links steal half of the biggest unfinished range.
+ * Demo file_client can receive file content into mapped file pages directly, see macro ST_ASIO_MAPPED_FILE_RECV in file_client.cpp.
+ * Demo file_client receives files in pieces with XXH64 hashes, corrupted pieces are received again, broken transmissions can be resumed.
  *
  * DELETION:
  *
@@ -402,6 +433,22 @@ namespace boost {namespace asio {typedef io_service io_context;}}
 	#error message capacity must be bigger than zero.
 #endif
 
+//after msgs been moved into the receiving buffer, they will be dispatched (via on_msg_handle) in batch, one post handles at most
+//ST_ASIO_MAX_DISPATCH_BATCH msgs (in sequence), and if ST_ASIO_DISPATCH_BATCH_DURATION is bigger than zero (unit is microsecond),
+//batch will also end after this duration, then the next batch will be posted, this gives other handlers a chance to run.
+//bigger batch means less io_context posts (and less async call tracking), but may starve other sockets if on_msg_handle is slow.
+#ifndef ST_ASIO_MAX_DISPATCH_BATCH
+#define ST_ASIO_MAX_DISPATCH_BATCH		1
+#elif ST_ASIO_MAX_DISPATCH_BATCH <= 0
+	#error dispatch batch must be bigger than zero.
+#endif
+
+#ifndef ST_ASIO_DISPATCH_BATCH_DURATION
+#define ST_ASIO_DISPATCH_BATCH_DURATION	0 //microseconds, 0 means no time budget, only ST_ASIO_MAX_DISPATCH_BATCH takes effect
+#elif ST_ASIO_DISPATCH_BATCH_DURATION < 0
+	#error dispatch batch duration must be bigger than or equal to zero.
+#endif
+
 //buffer (on stack) size used when writing logs.
 #ifndef ST_ASIO_UNIFIED_OUT_BUF_NUM
 #define ST_ASIO_UNIFIED_OUT_BUF_NUM	2048
@@ -422,6 +469,23 @@ namespace boost {namespace asio {typedef io_service io_context;}}
 //#define ST_ASIO_USE_SYSTEM_TIMER
 //otherwise, boost::asio::deadline_timer will be used
 
+//if bigger than zero, timers will be managed by a hierarchical timing wheel (an io_context service, one wheel per CPU core), which
+//only needs a few asio timers no matter how many timers we have, the unit is millisecond, it's also the precision of all timers.
+//timers will never be fired earlier than they should, but maybe later (at most one tick). 0 means one asio timer per timer id.
+//ST_ASIO_USE_STEADY_TIMER and ST_ASIO_USE_SYSTEM_TIMER have no effects on the timing wheel.
+#ifndef ST_ASIO_TIMER_WHEEL_TICK
+#define ST_ASIO_TIMER_WHEEL_TICK	0
+#elif ST_ASIO_TIMER_WHEEL_TICK < 0
+	#error timer wheel tick must be bigger than or equal to zero.
+#endif
+
+//if defined, timer_info will be created on demand (when a timer id been used for the first time) rather than 255 timer_info
+//for every timer object, this saves a lot of memory if you have many objects (sockets), needs boost-1.53 or higher.
+//#define ST_ASIO_COMPACT_TIMER
+#if defined(ST_ASIO_COMPACT_TIMER) && BOOST_VERSION < 105300
+	#error macro ST_ASIO_COMPACT_TIMER needs boost-1.53 or higher.
+#endif
+
 //after this duration, this socket can be freed from the heap or reused,
 //you must define this macro as a value, not just define it, the value means the duration, unit is second.
 //a value equal to zero will cause st_asio_wrapper to use a mechanism to guarantee 100% safety when reusing or freeing this socket,
@@ -433,12 +497,37 @@ namespace boost {namespace asio {typedef io_service io_context;}}
 	#error "delay close duration must be bigger than or equal to zero."
 #endif
 
+//every socket has three memory blocks with this size (in bytes), one for async_read, one for async_write and one for msg dispatching,
+//asio will allocate its operations (include handlers) from them (via handler allocation hooks or associated allocator) rather than
+//global heap, and handlers will be passed to asio as is (without boost::function and boost::lambda wrappers).
+//if an operation is bigger than this size, global heap will be used. 0 means disable this feature, 512 is enough for most situations.
+#ifndef ST_ASIO_HANDLER_MEMORY_SIZE
+#define ST_ASIO_HANDLER_MEMORY_SIZE	0
+#elif ST_ASIO_HANDLER_MEMORY_SIZE < 0
+	#error handler memory size must be bigger than or equal to zero.
+#endif
+
+//if ST_ASIO_DELAY_CLOSE is equal to zero, st_asio_wrapper hooks all async calls by copying a shared_ptr into every handler (and every
+//copy of it), and polls (via a timer) the use count of this shared_ptr to find out when all async calls finished.
+//if this macro been defined, async calls will be counted via an atomic counter (only changed twice per async call), and on_close()
+//will be called as soon as the last async call finished rather than polling via a timer. timers cannot be started during closing.
+//#define ST_ASIO_ASYNC_CALL_COUNTER
+#if defined(ST_ASIO_ASYNC_CALL_COUNTER) && ST_ASIO_DELAY_CLOSE > 0
+	#error macro ST_ASIO_ASYNC_CALL_COUNTER needs ST_ASIO_DELAY_CLOSE to be equal to zero.
+#endif
+
 //full statistic include time consumption, or only numerable informations will be gathered
 //#define ST_ASIO_FULL_STATISTIC
 
 //when got some msgs, not call on_msg(), but asynchronously dispatch them, on_msg_handle() will be called later.
 //#define ST_ASIO_FORCE_TO_USE_MSG_RECV_BUFFER
 
+//when got some msgs, call on_msgs() once with all of them rather than call on_msg() for each of them,
+//on_msgs() returns how many msgs been handled, others will be dispatched via on_msg_handle() later (unless congestion control been
+//opened, see socket::on_msgs for more details).
+//useless if macro ST_ASIO_FORCE_TO_USE_MSG_RECV_BUFFER been defined.
+//#define ST_ASIO_BATCH_ON_MSG
+
 //after every msg sent, call st_asio_wrapper::socket::on_msg_send()
 //#define ST_ASIO_WANT_MSG_SEND_NOTIFY
 
@@ -452,6 +541,16 @@ namespace boost {namespace asio {typedef io_service io_context;}}
 	#error object capacity must be bigger than zero.
 #endif
 
+//object_pool distributes objects into this amount of shards by their ids (id % ST_ASIO_OBJECT_POOL_SHARD_NUM), every shard has its own
+// containers and mutexes, so adding, deleting and finding objects in different shards will not block each other.
+//non-blocking broadcasting (see TCP_PARALLEL_BROADCAST_MSG) visits shards in parallel, see object_pool::parallel_do_something_to_all for more details.
+//1 means all objects share the same containers and mutexes (the old behavior), a value near the number of service threads is recommended.
+#ifndef ST_ASIO_OBJECT_POOL_SHARD_NUM
+#define ST_ASIO_OBJECT_POOL_SHARD_NUM	1
+#elif ST_ASIO_OBJECT_POOL_SHARD_NUM <= 0
+	#error object pool shard number must be bigger than zero.
+#endif
+
 //if defined, objects will never be freed, but remain in object_pool waiting for reuse.
 //#define ST_ASIO_REUSE_OBJECT
 
@@ -479,6 +578,14 @@ namespace boost {namespace asio {typedef io_service io_context;}}
 	#elif ST_ASIO_FREE_OBJECT_INTERVAL <= 0
 		#error free object interval must be bigger than zero.
 	#endif
+#elif defined(ST_ASIO_REUSE_OBJECT) && !defined(ST_ASIO_RESTORE_OBJECT)
+	//object_pool will invoke sweep_invalid_object() automatically and periodically to collect reusable objects, objects become reusable
+	// between two sweepings can only be reused after the next sweeping (except the oldest one), unit is second.
+	#ifndef ST_ASIO_SWEEP_OBJECT_INTERVAL
+	#define ST_ASIO_SWEEP_OBJECT_INTERVAL	1 //seconds
+	#elif ST_ASIO_SWEEP_OBJECT_INTERVAL <= 0
+		#error sweep object interval must be bigger than zero.
+	#endif
 #endif
 
 //define ST_ASIO_CLEAR_OBJECT_INTERVAL macro to let object_pool to invoke clear_obsoleted_object() automatically and periodically
@@ -499,6 +606,47 @@ namespace boost {namespace asio {typedef io_service io_context;}}
 	#error service thread number be bigger than zero.
 #endif
 
+//if bigger than zero, service_pump will own more than one io_context (as many as the parameter io_context_num of its constructor, which
+//defaults to ST_ASIO_SERVICE_THREAD_NUM, service_pump itself is the first one), and every service thread serves only one io_context,
+//so sockets will not share one reactor nor one handler queue, and all handlers of a socket will be invoked in the same thread.
+//new sockets (object_pool::create_object() and server_socket_base) will be placed via service_pump::assign_io_context():
+//1 - round-robin;
+//2 - least loaded (who has the least started sockets, see io_context_load).
+//please start at least as many service threads as io_contexts, and use object_pool::create_object() or service_pump::assign_io_context() to create
+//your own sockets too. 0 means only one io_context (the service_pump) served by all service threads.
+//ST_ASIO_DECREASE_THREAD_AT_RUNTIME and ST_ASIO_AVOID_AUTO_STOP_SERVICE only affect the first io_context, extra io_contexts will not
+//run out of work until service_pump::end_service() been invoked.
+#ifndef ST_ASIO_IO_CONTEXT_POOL
+#define ST_ASIO_IO_CONTEXT_POOL	0
+#elif ST_ASIO_IO_CONTEXT_POOL < 0 || ST_ASIO_IO_CONTEXT_POOL > 2
+	#error io_context pool placement policy can only be 0, 1 or 2.
+#endif
+
+//service threads placement policy (see service_pump::thread_cpu, rewrite it to place service threads by yourself):
+//0 - don't bind service threads to any CPUs;
+//1 - bind the Nth service thread to the Nth CPU (of all CPUs this process can run on, wrap around if not enough);
+//2 - like 1, but CPUs are interleaved across NUMA nodes (node0's 1st CPU, node1's 1st CPU, node0's 2nd CPU...), linux only, otherwise works like 1.
+//the thread which invoked service_pump::run_service is the first service thread, it will not be bound.
+//with ST_ASIO_IO_CONTEXT_POOL, every io_context (and all sockets belong to it) will be served in one CPU.
+#ifndef ST_ASIO_THREAD_AFFINITY
+#define ST_ASIO_THREAD_AFFINITY	0
+#elif ST_ASIO_THREAD_AFFINITY < 0 || ST_ASIO_THREAD_AFFINITY > 2
+	#error thread affinity policy can only be 0, 1 or 2.
+#endif
+
+//how many NUMA nodes will be probed (from /sys/devices/system/node/) at most.
+#ifndef ST_ASIO_MAX_NUMA_NODE_NUM
+#define ST_ASIO_MAX_NUMA_NODE_NUM	8
+#elif ST_ASIO_MAX_NUMA_NODE_NUM <= 0
+	#error max NUMA node number must be bigger than zero.
+#endif
+
+//if defined, the default unpacker (created in the constructor) will be re-created in the service thread which serves this socket just before
+//the first receiving, so its buffer will be allocated (first touched) on the NUMA node of that thread, it's useful only if the service thread
+//is bound to a CPU (see ST_ASIO_THREAD_AFFINITY) and the socket always be served by the same thread (see ST_ASIO_IO_CONTEXT_POOL).
+//a customized unpacker (via unpacker(const boost::shared_ptr<i_unpacker>&)) will not be re-created.
+//#define ST_ASIO_LOCAL_UNPACKER
+
 //graceful shutdown must finish within this duration, otherwise, socket will be forcedly shut down.
 #ifndef ST_ASIO_GRACEFUL_SHUTDOWN_MAX_DURATION
 #define ST_ASIO_GRACEFUL_SHUTDOWN_MAX_DURATION	5 //seconds
@@ -512,6 +660,16 @@ namespace boost {namespace asio {typedef io_service io_context;}}
 #define ST_ASIO_RECONNECT_INTERVAL	500 //millisecond(s)
 #endif
 
+//how many acceptors listen on the same address (via SO_REUSEPORT, so the kernel will spread new connections among them),
+//they will be spread across io_contexts (see ST_ASIO_IO_CONTEXT_POOL) too, and accepted sockets stay in their acceptor's io_context
+//(see server_base::assign_io_context), so please make it a multiple of io_context number, every acceptor has ST_ASIO_ASYNC_ACCEPT_NUM async_accept delivered,
+//see server_base::accept_num for per-acceptor statistic. bigger than 1 needs SO_REUSEPORT (linux 3.9 or higher, BSD and macOS).
+#ifndef ST_ASIO_ACCEPTOR_NUM
+#define ST_ASIO_ACCEPTOR_NUM	1
+#elif ST_ASIO_ACCEPTOR_NUM <= 0
+	#error acceptor number must be bigger than zero.
+#endif
+
 //how many async_accept delivery concurrently
 #ifndef ST_ASIO_ASYNC_ACCEPT_NUM
 #define ST_ASIO_ASYNC_ACCEPT_NUM	16
@@ -519,6 +677,23 @@ namespace boost {namespace asio {typedef io_service io_context;}}
 	#error async accept number must be bigger than zero.
 #endif
 
+//the number of outstanding async_accept (per acceptor) will be adapted between ST_ASIO_ASYNC_ACCEPT_NUM and this value according to
+//the accept rate: it doubles when all async_accept been consumed (or batch accepting got connections from the backlog), and decreases by one
+//when a connection arrived after one second or more of idle. equal to ST_ASIO_ASYNC_ACCEPT_NUM means fixed concurrency.
+#ifndef ST_ASIO_MAX_ASYNC_ACCEPT_NUM
+#define ST_ASIO_MAX_ASYNC_ACCEPT_NUM	ST_ASIO_ASYNC_ACCEPT_NUM
+#elif ST_ASIO_MAX_ASYNC_ACCEPT_NUM < ST_ASIO_ASYNC_ACCEPT_NUM
+	#error max async accept number must be bigger than or equal to ST_ASIO_ASYNC_ACCEPT_NUM.
+#endif
+
+//after an async_accept succeeded, accept at most this number of connections from the backlog synchronously (the acceptor will be put into
+//non-blocking mode), so a connection storm can be absorbed without a round trip through the reactor per connection. 0 means disable it.
+#ifndef ST_ASIO_ACCEPT_BATCH
+#define ST_ASIO_ACCEPT_BATCH	0
+#elif ST_ASIO_ACCEPT_BATCH < 0
+	#error accept batch must be bigger than or equal to zero.
+#endif
+
 //in set_server_addr, if the IP is empty, ST_ASIO_TCP_DEFAULT_IP_VERSION will define the IP version, or the IP version will be deduced by the IP address.
 //boost::asio::ip::tcp::v4() means ipv4 and boost::asio::ip::tcp::v6() means ipv6.
 #ifndef ST_ASIO_TCP_DEFAULT_IP_VERSION
@@ -543,9 +718,77 @@ namespace boost {namespace asio {typedef io_service io_context;}}
 #ifndef ST_ASIO_OUTPUT_CONTAINER
 #define ST_ASIO_OUTPUT_CONTAINER list
 #endif
+//chunk_list can be used as the container too, it stores messages in fixed size arrays and reuses them, so it's more
+//efficient than list (which allocates memory for every message) when the queue is deep.
 //we also can control the queues (and their containers) via template parameters on calss 'client_socket_base'
 //'server_socket_base', 'ssl::client_socket_base' and 'ssl::server_socket_base'.
 //we even can let a socket to use different queue (and / or different container) for input and output via template parameters.
+//lock_free_queue (needs boost-1.53 or higher) can be used as input queue if many threads send messages via the same socket,
+//it never blocks senders, but clear, swap and dequeue can only be invoked by the consumer (socket itself), so don't call
+//pop_first_pending_send_msg or pop_all_pending_send_msg while the socket is sending messages.
+
+//how many gather buffers can be sent via one async_write at most (tcp only), every tcp::socket_base has a fixed size const_buffer
+//array with this size, which is reused by every async_write. one writev can only carry at most 64 buffers in asio,
+//and this value can not exceed IOV_MAX.
+#ifndef ST_ASIO_MAX_SEND_BUF_NUM
+#define ST_ASIO_MAX_SEND_BUF_NUM	64
+#elif ST_ASIO_MAX_SEND_BUF_NUM <= 0
+	#error max send buffer number must be bigger than zero.
+#endif
+
+//stop gathering messages if they reached this size (in bytes) in one async_write (tcp only).
+#ifndef ST_ASIO_MAX_SEND_SIZE
+#define ST_ASIO_MAX_SEND_SIZE	65536
+#elif ST_ASIO_MAX_SEND_SIZE <= 0
+	#error max send size must be bigger than zero.
+#endif
+
+//messages which are not bigger than ST_ASIO_MERGE_MSG_SIZE will be copied into a contiguous buffer (ST_ASIO_MERGE_BUFFER_SIZE bytes,
+//every tcp::socket_base has one), consecutive small messages then only take one gather buffer, 0 means don't merge.
+#ifndef ST_ASIO_MERGE_MSG_SIZE
+#define ST_ASIO_MERGE_MSG_SIZE		0
+#elif ST_ASIO_MERGE_MSG_SIZE < 0
+	#error merge message size must be bigger than or equal to zero.
+#endif
+
+#ifndef ST_ASIO_MERGE_BUFFER_SIZE
+#define ST_ASIO_MERGE_BUFFER_SIZE	4096
+#elif ST_ASIO_MERGE_BUFFER_SIZE < ST_ASIO_MERGE_MSG_SIZE
+	#error merge buffer size must be bigger than or equal to merge message size.
+#endif
+
+//like Nagle's algorithm, if there are neither enough messages to fill all gather buffers nor enough bytes to reach ST_ASIO_MAX_SEND_SIZE,
+//wait for this duration (unit is microsecond) before sending them, this leads to fewer system calls and fuller TCP segments,
+//but increases latency, 0 means don't wait.
+//with macro ST_ASIO_WANT_MSG_SEND_NOTIFY, every async_write carries only one message, so lingering is meaningless and will be disabled.
+#ifndef ST_ASIO_SEND_LINGER
+#define ST_ASIO_SEND_LINGER			0
+#elif ST_ASIO_SEND_LINGER < 0
+	#error send linger must be bigger than or equal to zero.
+#elif ST_ASIO_SEND_LINGER > 0 && defined(ST_ASIO_WANT_MSG_SEND_NOTIFY)
+	#undef ST_ASIO_SEND_LINGER
+	#define ST_ASIO_SEND_LINGER		0
+#endif
+
+//#define ST_ASIO_ZERO_COPY_SEND
+//messages which implement i_file_source will be sent via sendfile(2) (linux only) from the page cache to the socket directly,
+//if sendfile is not available (other platforms, or not supported by the file), tcp::socket_base falls back to pread and async_write,
+//which still reads the file in the sending logic rather than in on_msg_send. don't send file ranges via sync_send_msg.
+//ssl sockets can not send file ranges, because the content must be encrypted in user space.
+//sendfile has no MSG_NOSIGNAL, it raises SIGPIPE if the peer closed the connection, so the application must ignore SIGPIPE
+//(signal(SIGPIPE, SIG_IGN) at process start), then sendfile just fails with EPIPE like other sending functions.
+#ifdef ST_ASIO_ZERO_COPY_SEND
+	#ifdef _MSC_VER
+		#error zero copy sending is not supported on Windows.
+	#endif
+
+	//send at most this many bytes (via sendfile or pread) before giving other handlers in the same io_context a chance to run.
+	#ifndef ST_ASIO_MAX_SEND_FILE_SIZE
+	#define ST_ASIO_MAX_SEND_FILE_SIZE	1048576
+	#elif ST_ASIO_MAX_SEND_FILE_SIZE <= 0
+		#error max send file size must be bigger than zero.
+	#endif
+#endif
 
 //buffer type used when receiving messages (unpacker's prepare_next_recv() need to return this type)
 #ifndef ST_ASIO_RECV_BUFFER_TYPE
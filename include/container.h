@@ -13,6 +13,9 @@
 #ifndef ST_ASIO_CONTAINER_H_
 #define ST_ASIO_CONTAINER_H_
 
+#include <boost/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
 #include "base.h"
 
 namespace st_asio_wrapper
@@ -21,6 +24,117 @@ namespace st_asio_wrapper
 //st_asio_wrapper requires that container must take one and only one template argument.
 template<typename T> class list : public boost::container::list<T> {};
 
+//items are stored in fixed size arrays (chunks) rather than one node per item, which means much less memory allocations and
+//better cache locality when the queue is deep. emptied chunks are kept (at most MAX_SPARE_CHUNK) for reusing, no locks are needed
+//for this chunk pool, because containers are protected by queues (or only accessed by one thread).
+//only appending is supported by splice (queue only invokes splice(end(), can)), so const_iterator is just a placeholder.
+template<typename T> class chunk_list : public boost::noncopyable
+{
+private:
+	enum {CHUNK_SIZE = 32, MAX_SPARE_CHUNK = 4};
+	struct chunk
+	{
+		boost::aligned_storage<sizeof(T) * CHUNK_SIZE, boost::alignment_of<T>::value> storage;
+		chunk* next;
+
+		chunk() : next(NULL) {}
+		T* items() {return static_cast<T*>(storage.address());}
+	};
+
+public:
+	struct const_iterator {};
+
+	chunk_list() {do_init();}
+	chunk_list(size_t capacity) {do_init(); for (capacity = (capacity + CHUNK_SIZE - 1) / CHUNK_SIZE; capacity > 0 && spare_num < MAX_SPARE_CHUNK; --capacity) put_chunk(new chunk());}
+	~chunk_list() {clear(); delete head; while (NULL != spare) {chunk* next = spare->next; delete spare; spare = next;}}
+
+	size_t size() const {return num;}
+	bool empty() const {return 0 == num;}
+	void clear() {while (!empty()) pop_front();}
+	void swap(chunk_list& other)
+	{
+		std::swap(head, other.head); std::swap(tail, other.tail); std::swap(spare, other.spare);
+		std::swap(head_index, other.head_index); std::swap(tail_index, other.tail_index);
+		std::swap(num, other.num); std::swap(spare_num, other.spare_num);
+	}
+
+	void emplace_back() {new (prepare_back()) T(); ++tail_index; ++num;}
+	void emplace_back(const T& item) {new (prepare_back()) T(item); ++tail_index; ++num;}
+	const_iterator end() const {return const_iterator();}
+	void splice(const_iterator, boost::container::list<T>& can) {for (BOOST_AUTO(iter, can.begin()); iter != can.end(); ++iter) {emplace_back(); back().swap(*iter);} can.clear();}
+
+	T& front() {assert(!empty()); return head->items()[head_index];}
+	T& back() {assert(!empty()); return tail->items()[tail_index - 1];}
+	void pop_front()
+	{
+		assert(!empty());
+		front().~T();
+		--num;
+
+		if (head == tail)
+		{
+			if (++head_index == tail_index) //the last chunk becomes empty, keep it
+				head_index = tail_index = 0;
+		}
+		else if (CHUNK_SIZE == ++head_index)
+		{
+			chunk* next = head->next;
+			put_chunk(head);
+			head = next;
+			head_index = 0;
+		}
+	}
+
+private:
+	void do_init() {head = tail = spare = NULL; head_index = tail_index = 0; num = spare_num = 0;}
+
+	T* prepare_back()
+	{
+		if (NULL == tail)
+			head = tail = get_chunk();
+		else if (CHUNK_SIZE == tail_index)
+		{
+			tail->next = get_chunk();
+			tail = tail->next;
+			tail_index = 0;
+		}
+
+		return tail->items() + tail_index;
+	}
+
+	chunk* get_chunk()
+	{
+		if (NULL == spare)
+			return new chunk();
+
+		chunk* c = spare;
+		spare = spare->next;
+		--spare_num;
+
+		c->next = NULL;
+		return c;
+	}
+
+	void put_chunk(chunk* c)
+	{
+		if (spare_num >= MAX_SPARE_CHUNK)
+			delete c;
+		else
+		{
+			c->next = spare;
+			spare = c;
+			++spare_num;
+		}
+	}
+
+private:
+	chunk* head;
+	chunk* tail;
+	chunk* spare;
+	size_t head_index, tail_index; //head_index is the first item in head chunk, tail_index is the next free slot in tail chunk
+	size_t num, spare_num;
+};
+
 class dummy_lockable
 {
 public:
@@ -99,6 +213,135 @@ public:
 	lock_queue(size_t capacity) : queue<T, Container, lockable>(capacity) {}
 };
 
+#if BOOST_VERSION >= 105300
+//multiple producers, single consumer, lock-free.
+//producers push items onto an intrusive stack via CAS, the consumer takes the whole stack via one atomic exchange (drain_into),
+//reverses it to restore FIFO order and then moves items into Container, which only the consumer accesses.
+//enqueue, enqueue_, move_items_in, move_items_in_, size and empty can be invoked in any thread concurrently,
+//all other functions can only be invoked by the consumer (for send_msg_buffer, it's socket's sending logic, see socket::do_send_msg).
+template<typename T, typename Container> class lock_free_queue : public Container, public dummy_lockable
+{
+private:
+	struct node
+	{
+		T item;
+		node* next;
+
+		node() : next(NULL) {}
+		node(const T& item_) : item(item_), next(NULL) {}
+	};
+
+public:
+	typedef T data_type;
+
+	lock_free_queue() : head(NULL), num(0) {}
+	lock_free_queue(size_t capacity) : Container(capacity), head(NULL), num(0) {}
+	~lock_free_queue() {free_nodes(head.exchange(NULL, boost::memory_order_acquire));}
+
+	bool is_thread_safe() const {return true;}
+	size_t size() const {return num.load(boost::memory_order_relaxed);}
+	bool empty() const {return 0 == size();}
+	void clear() {drain_into(*this); num.fetch_sub(Container::size(), boost::memory_order_relaxed); Container::clear();}
+	void swap(Container& other)
+	{
+		drain_into(*this);
+		num.fetch_sub(Container::size(), boost::memory_order_relaxed);
+		Container::swap(other);
+		num.fetch_add(Container::size(), boost::memory_order_relaxed);
+	}
+
+	//thread safe
+	bool enqueue(const T& item) {return enqueue_(item);}
+	bool enqueue(T& item) {return enqueue_(item);}
+	void move_items_in(boost::container::list<T>& can) {move_items_in_(can);}
+	bool try_dequeue(T& item) {return try_dequeue_(item);}
+
+	//also thread safe for producers, '_' is kept for the compatibility with queue
+	bool enqueue_(const T& item) {BOOST_AUTO(n, new node(item)); push(n, n, 1); return true;}
+	bool enqueue_(T& item) {BOOST_AUTO(n, new node()); n->item.swap(item); push(n, n, 1); return true;} //after this, item will becomes empty, please note.
+	void move_items_in_(boost::container::list<T>& can)
+	{
+		node* top = NULL;
+		node* bottom = NULL;
+		for (BOOST_AUTO(iter, can.begin()); iter != can.end(); ++iter)
+		{
+			BOOST_AUTO(n, new node());
+			n->item.swap(*iter);
+			n->next = top;
+			top = n;
+			if (NULL == bottom)
+				bottom = n;
+		}
+
+		size_t size = can.size();
+		can.clear();
+		if (NULL != top)
+			push(top, bottom, size);
+	}
+
+	//consumer only
+	bool try_dequeue_(T& item)
+	{
+		if (Container::empty() && 0 == drain_into(*this))
+			return false;
+
+		item.swap(ST_THIS front());
+		ST_THIS pop_front();
+		num.fetch_sub(1, boost::memory_order_relaxed);
+		return true;
+	}
+
+	//move all items pushed by producers so far into can (append to the end) with only one atomic operation,
+	//items in Container (taken by previous drain_into) are not affected, so call it with *this to refill the consumer side.
+	//return the number of moved items, num will not be changed because these items are still hold by this queue (or the caller).
+	size_t drain_into(Container& can)
+	{
+		node* n = head.exchange(NULL, boost::memory_order_acquire);
+		if (NULL == n)
+			return 0;
+
+		node* prev = NULL; //reverse to FIFO order
+		while (NULL != n)
+		{
+			node* next = n->next;
+			n->next = prev;
+			prev = n;
+			n = next;
+		}
+
+		size_t size = 0;
+		for (n = prev; NULL != n; ++size)
+		{
+			can.emplace_back();
+			can.back().swap(n->item);
+
+			node* next = n->next;
+			delete n;
+			n = next;
+		}
+
+		return size;
+	}
+
+private:
+	void push(node* top, node* bottom, size_t size)
+	{
+		num.fetch_add(size, boost::memory_order_relaxed);
+
+		node* old_head = head.load(boost::memory_order_relaxed);
+		do
+			bottom->next = old_head;
+		while (!head.compare_exchange_weak(old_head, top, boost::memory_order_release, boost::memory_order_relaxed));
+	}
+
+	static void free_nodes(node* n) {while (NULL != n) {node* next = n->next; delete n; n = next;}}
+
+private:
+	boost::atomic<node*> head;
+	atomic_size_t num; //items in both the stack and Container
+};
+#endif
+
 } //namespace
 
 #endif /* ST_ASIO_CONTAINER_H_ */
@@ -28,6 +28,27 @@
 	#error message buffer size must be bigger than zero.
 #endif
 
+//the alignment of immutable_buffer's memory block, must be a power of 2.
+#ifndef ST_ASIO_CACHE_LINE_SIZE
+#define ST_ASIO_CACHE_LINE_SIZE	64
+#elif ST_ASIO_CACHE_LINE_SIZE <= 0 || (ST_ASIO_CACHE_LINE_SIZE & (ST_ASIO_CACHE_LINE_SIZE - 1)) != 0
+	#error cache line size must be a power of 2.
+#endif
+
+//every thread caches at most this amount of free buffers for every size class in buffer_pool, see buffer_pool for more details.
+#ifndef ST_ASIO_MAX_POOLED_BUFFER_NUM
+#define ST_ASIO_MAX_POOLED_BUFFER_NUM	64
+#elif ST_ASIO_MAX_POOLED_BUFFER_NUM < 0
+	#error the number of pooled buffers must be equal to or bigger than zero.
+#endif
+
+//max number of body fragments a gather_buffer can refer to, see gather_buffer for more details.
+#ifndef ST_ASIO_MAX_GATHER_FRAGMENT_NUM
+#define ST_ASIO_MAX_GATHER_FRAGMENT_NUM	4
+#elif ST_ASIO_MAX_GATHER_FRAGMENT_NUM <= 0
+	#error the number of gather fragments must be bigger than zero.
+#endif
+
 //#define ST_ASIO_SCATTERED_RECV_BUFFER
 //define this macro will introduce scatter-gather buffers when doing async read, it's very useful under certain situations (for example, ring buffer).
 //this macro is used by unpackers only, it doesn't belong to st_asio_wrapper.
@@ -84,6 +105,289 @@ protected:
 	size_t len, buff_len;
 };
 
+//a slice of a reference-counted memory block (slab), copying a slab_buffer only increases the slab's reference count,
+//the slab will be freed after the last slab_buffer which refers to it been destroyed (or cleared).
+//please note that a small slab_buffer will hold the whole slab, so don't keep it for a long time if memory is precious.
+class slab_buffer
+{
+public:
+	typedef boost::shared_array<char> slab_type;
+
+	slab_buffer() : buff(NULL), len(0) {}
+	slab_buffer(const slab_type& _slab, const char* _buff, size_t _len) : slab(_slab), buff(_buff), len(_len) {}
+
+	//the following five functions are needed by st_asio_wrapper
+	bool empty() const {return 0 == len;}
+	size_t size() const {return len;}
+	const char* data() const {return buff;}
+	void swap(slab_buffer& other) {slab.swap(other.slab); std::swap(buff, other.buff); std::swap(len, other.len);}
+	void clear() {slab.reset(); buff = NULL; len = 0;}
+
+	const slab_type& raw_slab() const {return slab;}
+
+protected:
+	slab_type slab;
+	const char* buff;
+	size_t len;
+};
+
+//an immutable and reference-counted memory block, the reference count and the data are allocated together (one memory allocation),
+//copying an immutable_buffer only increases the reference count, so one packed message can be sent via many sockets without copying.
+//the data starts at a cache line boundary (ST_ASIO_CACHE_LINE_SIZE) and the reference count lives in the previous cache line, so
+//increasing and decreasing the reference count in many threads will not invalidate the cache lines of the data.
+class immutable_buffer
+{
+private:
+	struct block
+	{
+		atomic_size_t ref;
+		size_t len;
+		char* raw; //the address returned by new[]
+
+		block(char* _raw, size_t _len) : ref(1), len(_len), raw(_raw) {}
+		char* data() {return (char*) this + HEAD_SPACE;}
+	};
+	enum {HEAD_SPACE = (sizeof(block) + ST_ASIO_CACHE_LINE_SIZE - 1) / ST_ASIO_CACHE_LINE_SIZE * ST_ASIO_CACHE_LINE_SIZE};
+
+public:
+	immutable_buffer() : blk(NULL) {}
+	immutable_buffer(const immutable_buffer& other) : blk(other.blk) {if (NULL != blk) blk->ref.fetch_add(1, boost::memory_order_relaxed);}
+	~immutable_buffer() {clear();}
+	immutable_buffer& operator=(const immutable_buffer& other) {immutable_buffer(other).swap(*this); return *this;}
+
+	//the following five functions are needed by st_asio_wrapper
+	bool empty() const {return 0 == size();}
+	size_t size() const {return NULL == blk ? 0 : blk->len;}
+	const char* data() const {return NULL == blk ? NULL : blk->data();}
+	void swap(immutable_buffer& other) {std::swap(blk, other.blk);}
+	void clear()
+	{
+		if (NULL != blk && 1 == blk->ref.fetch_sub(1, boost::memory_order_acq_rel))
+		{
+			char* raw = blk->raw;
+			blk->~block();
+			delete[] raw;
+		}
+		blk = NULL;
+	}
+
+	//allocate a new block and return its data area, the data can only be filled before this buffer been copied (shared).
+	char* assign(size_t len)
+	{
+		clear();
+
+		char* raw = new char[HEAD_SPACE + len + ST_ASIO_CACHE_LINE_SIZE - 1];
+		char* aligned = (char*) (((size_t) raw + ST_ASIO_CACHE_LINE_SIZE - 1) & ~((size_t) ST_ASIO_CACHE_LINE_SIZE - 1));
+		blk = new (aligned) block(raw, len);
+
+		return blk->data();
+	}
+
+	size_t ref_count() const {return NULL == blk ? 0 : blk->ref.load(boost::memory_order_relaxed);}
+
+private:
+	block* blk;
+};
+
+//size-classed (powers of 2, from MIN_CLASS_SIZE) memory pool, every thread has its own free lists (ST_ASIO_MAX_POOLED_BUFFER_NUM buffers
+//at most for each size class), so no locks are needed. a buffer is returned to the pool of the thread which frees it, for output messages,
+//it's the service thread which invokes tcp::socket_base::send_handler. buffers bigger than the biggest size class will not be pooled.
+template<typename Dummy = void> class buffer_pool_
+{
+public:
+	enum {MIN_CLASS_SIZE = 64, CLASS_NUM = 16};
+
+	//size will be rounded up to the size of the size class.
+	static char* allocate(size_t& size)
+	{
+		size_t index = size_class(size);
+		if (index < CLASS_NUM)
+		{
+			size = (size_t) MIN_CLASS_SIZE << index;
+
+			std::vector<char*>& free_can = local_pool().free_cans[index];
+			if (!free_can.empty())
+			{
+				hit_num_.fetch_add(1, boost::memory_order_relaxed);
+				char* buff = free_can.back();
+				free_can.pop_back();
+				return buff;
+			}
+		}
+
+		miss_num_.fetch_add(1, boost::memory_order_relaxed);
+		return new char[size];
+	}
+
+	//size must be the one returned by allocate.
+	static void deallocate(char* buff, size_t size)
+	{
+		size_t index = size_class(size);
+		if (index < CLASS_NUM)
+		{
+			std::vector<char*>& free_can = local_pool().free_cans[index];
+			if (free_can.size() < (size_t) ST_ASIO_MAX_POOLED_BUFFER_NUM)
+			{
+				free_can.push_back(buff);
+				return;
+			}
+		}
+
+		delete[] buff;
+	}
+
+	static boost::uint_fast64_t hit_num() {return hit_num_.load(boost::memory_order_relaxed);}
+	static boost::uint_fast64_t miss_num() {return miss_num_.load(boost::memory_order_relaxed);}
+	static float hit_rate() {boost::uint_fast64_t hit = hit_num(), total = hit + miss_num(); return 0 == total ? 0.f : (float) hit / total;}
+	static void reset_statistic() {hit_num_.store(0, boost::memory_order_relaxed); miss_num_.store(0, boost::memory_order_relaxed);}
+
+private:
+	struct pool
+	{
+		std::vector<char*> free_cans[CLASS_NUM];
+
+		pool() {for (size_t i = 0; i < CLASS_NUM; ++i) free_cans[i].reserve(ST_ASIO_MAX_POOLED_BUFFER_NUM);}
+		~pool() {for (size_t i = 0; i < CLASS_NUM; ++i) for (BOOST_AUTO(iter, free_cans[i].begin()); iter != free_cans[i].end(); ++iter) delete[] *iter;}
+	};
+
+	static size_t size_class(size_t size) {size_t index = 0; for (size_t class_size = MIN_CLASS_SIZE; class_size < size && index < CLASS_NUM; class_size <<= 1) ++index; return index;}
+	static pool& local_pool() {pool* p = local_pool_.get(); if (NULL == p) local_pool_.reset(p = new pool()); return *p;}
+
+private:
+	static boost::thread_specific_ptr<pool> local_pool_; //the pool will be freed when the thread exits
+	static atomic_uint_fast64 hit_num_, miss_num_;
+};
+template<typename Dummy> boost::thread_specific_ptr<typename buffer_pool_<Dummy>::pool> buffer_pool_<Dummy>::local_pool_;
+template<typename Dummy> atomic_uint_fast64 buffer_pool_<Dummy>::hit_num_(0);
+template<typename Dummy> atomic_uint_fast64 buffer_pool_<Dummy>::miss_num_(0);
+typedef buffer_pool_<> buffer_pool;
+
+//a buffer whose memory comes from buffer_pool and goes back to buffer_pool when it's cleared (or destroyed).
+class pooled_buffer : public boost::noncopyable
+{
+public:
+	pooled_buffer() : buff(NULL), len(0), buff_len(0) {}
+	~pooled_buffer() {clear();}
+
+	//the following five functions are needed by st_asio_wrapper
+	bool empty() const {return 0 == len;}
+	size_t size() const {return len;}
+	const char* data() const {return buff;}
+	void swap(pooled_buffer& other) {std::swap(buff, other.buff); std::swap(len, other.len); std::swap(buff_len, other.buff_len);}
+	void clear() {if (NULL != buff) buffer_pool::deallocate(buff, buff_len); buff = NULL; len = buff_len = 0;}
+
+	char* data() {return buff;}
+	//allocate a buffer which can hold at least len bytes, and return it.
+	char* assign(size_t _len) {clear(); buff_len = _len; buff = buffer_pool::allocate(buff_len); len = _len; return buff;}
+	size_t buffer_size() const {return buff_len;}
+
+protected:
+	char* buff;
+	size_t len, buff_len;
+};
+
+//a small header stored inline plus references to at most ST_ASIO_MAX_GATHER_FRAGMENT_NUM body fragments, tcp::socket_base sends the header
+//and every fragment as separate gather buffers (see msg_buffer_traits), so the body will not be copied just for prepending a header.
+//a fragment is either caller-owned (must be kept valid until it has been sent) or held by an immutable_buffer (reference-counted).
+//copying a gather_buffer only copies references, so it can be used in broadcasting (see TCP_SHARED_BROADCAST_MSG).
+//please note that data() only returns the header, use msg_buffer_traits to visit the whole message.
+class gather_buffer
+{
+public:
+	enum {MAX_HEAD_LEN = 8, MAX_FRAGMENT_NUM = ST_ASIO_MAX_GATHER_FRAGMENT_NUM};
+	struct fragment
+	{
+		const char* buff;
+		size_t len;
+		immutable_buffer holder;
+
+		fragment() : buff(NULL), len(0) {}
+	};
+
+	gather_buffer() : head_len(0), fragment_num(0), total_len(0) {}
+
+	//the following five functions are needed by st_asio_wrapper
+	bool empty() const {return 0 == total_len;}
+	size_t size() const {return total_len;}
+	const char* data() const {return head;}
+	void swap(gather_buffer& other)
+	{
+		std::swap_ranges(head, head + MAX_HEAD_LEN, other.head);
+		for (size_t i = 0; i < std::max(fragment_num, other.fragment_num); ++i)
+		{
+			std::swap(fragments[i].buff, other.fragments[i].buff);
+			std::swap(fragments[i].len, other.fragments[i].len);
+			fragments[i].holder.swap(other.fragments[i].holder);
+		}
+		std::swap(head_len, other.head_len); std::swap(fragment_num, other.fragment_num); std::swap(total_len, other.total_len);
+	}
+	void clear() {for (size_t i = 0; i < fragment_num; ++i) fragments[i] = fragment(); head_len = fragment_num = total_len = 0;}
+
+	bool set_head(const void* _head, size_t len)
+	{
+		if (len > MAX_HEAD_LEN)
+			return false;
+
+		memcpy(head, _head, len);
+		total_len += len - head_len;
+		head_len = len;
+		return true;
+	}
+	size_t head_size() const {return head_len;}
+
+	bool add_fragment(const char* buff, size_t len) {return add_fragment(buff, len, immutable_buffer());}
+	bool add_fragment(const immutable_buffer& holder) {return add_fragment(holder.data(), holder.size(), holder);}
+	size_t fragment_size() const {return fragment_num;}
+	const fragment& get_fragment(size_t index) const {assert(index < fragment_num); return fragments[index];}
+
+private:
+	bool add_fragment(const char* buff, size_t len, const immutable_buffer& holder)
+	{
+		if (fragment_num >= MAX_FRAGMENT_NUM)
+			return false;
+		else if (NULL != buff && len > 0)
+		{
+			fragment& f = fragments[fragment_num++];
+			f.buff = buff;
+			f.len = len;
+			f.holder = holder;
+			total_len += len;
+		}
+
+		return true;
+	}
+
+private:
+	char head[MAX_HEAD_LEN];
+	size_t head_len, fragment_num, total_len;
+	fragment fragments[MAX_FRAGMENT_NUM];
+};
+
 }} //namespace
 
+namespace st_asio_wrapper
+{
+
+template<>
+struct msg_buffer_traits<ext::gather_buffer>
+{
+	enum {MAX_BUFFER_NUM = 1 + ext::gather_buffer::MAX_FRAGMENT_NUM};
+
+	static size_t buffer_num(const ext::gather_buffer& msg) {return (msg.head_size() > 0 ? 1 : 0) + msg.fragment_size();}
+	static boost::asio::const_buffer buffer(const ext::gather_buffer& msg, size_t index)
+	{
+		if (msg.head_size() > 0)
+		{
+			if (0 == index)
+				return boost::asio::const_buffer(msg.data(), msg.head_size());
+			--index;
+		}
+
+		const ext::gather_buffer::fragment& f = msg.get_fragment(index);
+		return boost::asio::const_buffer(f.buff, f.len);
+	}
+};
+
+} //namespace
+
 #endif /* ST_ASIO_EXT_H_ */
@@ -142,6 +142,186 @@ public:
 	virtual size_t raw_data_len(typename super::msg_ctype& msg) const {return msg.size() - ST_ASIO_HEAD_LEN;}
 };
 
+//protocol: length + body
+//pack messages into T directly (no intermediate std::string), T must provide char* assign(size_t len) which allocates the buffer.
+//T can be immutable_buffer (see immutable_packer) or pooled_buffer (see pooled_packer).
+template<typename T>
+class buffer_packer : public i_packer<T>
+{
+private:
+	typedef i_packer<T> super;
+
+public:
+	static size_t get_max_msg_size() {return ST_ASIO_MSG_BUFFER_SIZE - ST_ASIO_HEAD_LEN;}
+
+	using super::pack_msg;
+	virtual bool pack_msg(typename super::msg_type& msg, const char* const pstr[], const size_t len[], size_t num, bool native = false)
+	{
+		msg.clear();
+		size_t pre_len = native ? 0 : ST_ASIO_HEAD_LEN;
+		size_t total_len = packer_helper::msg_size_check(pre_len, pstr, len, num);
+		if ((size_t) -1 == total_len)
+			return false;
+		else if (total_len > pre_len)
+		{
+			ST_ASIO_HEAD_TYPE head_len = (ST_ASIO_HEAD_TYPE) total_len;
+			if (!native && total_len != head_len)
+			{
+				unified_out::error_out("pack msg error: length exceeded the header's range!");
+				return false;
+			}
+
+			char* buff = msg.assign(total_len);
+			if (!native)
+			{
+				head_len = ST_ASIO_HEAD_H2N(head_len);
+				memcpy(buff, &head_len, ST_ASIO_HEAD_LEN);
+				buff += ST_ASIO_HEAD_LEN;
+			}
+
+			for (size_t i = 0; i < num; ++i)
+				if (NULL != pstr[i])
+				{
+					memcpy(buff, pstr[i], len[i]);
+					buff += len[i];
+				}
+		} //if (total_len > pre_len)
+
+		return true;
+	}
+	virtual bool pack_heartbeat(typename super::msg_type& msg)
+	{
+		ST_ASIO_HEAD_TYPE head_len = ST_ASIO_HEAD_LEN;
+		head_len = ST_ASIO_HEAD_H2N(head_len);
+		memcpy(msg.assign(ST_ASIO_HEAD_LEN), &head_len, ST_ASIO_HEAD_LEN);
+
+		return true;
+	}
+
+	//do not use following helper functions for heartbeat messages.
+	virtual char* raw_data(typename super::msg_type& msg) const {return const_cast<char*>(boost::next(msg.data(), ST_ASIO_HEAD_LEN));}
+	virtual const char* raw_data(typename super::msg_ctype& msg) const {return boost::next(msg.data(), ST_ASIO_HEAD_LEN);}
+	virtual size_t raw_data_len(typename super::msg_ctype& msg) const {return msg.size() - ST_ASIO_HEAD_LEN;}
+};
+
+//one packed message can be queued on many sockets (see direct_send_msg and TCP_SHARED_BROADCAST_MSG), each of them only increases the reference count.
+typedef buffer_packer<immutable_buffer> immutable_packer;
+//output buffers come from buffer_pool and go back to it after been sent, so no memory allocation after warming up.
+typedef buffer_packer<pooled_buffer> pooled_packer;
+
+//protocol: length + body
+//the length is stored in gather_buffer's header, and the body is referred to by fragments, so tcp::socket_base sends the length
+//and the body as separate gather buffers without concatenating them.
+class gather_packer : public i_packer<gather_buffer>
+{
+public:
+	static size_t get_max_msg_size() {return ST_ASIO_MSG_BUFFER_SIZE - ST_ASIO_HEAD_LEN;}
+
+	using i_packer<msg_type>::pack_msg;
+	//the body will be copied into one immutable_buffer, because we don't know the life cycle of pstr, use pack_ref_msg
+	//or the immutable_buffer version of pack_msg to avoid the copying.
+	virtual bool pack_msg(msg_type& msg, const char* const pstr[], const size_t len[], size_t num, bool native = false)
+	{
+		size_t total_len = packer_helper::msg_size_check(0, pstr, len, num);
+		if ((size_t) -1 == total_len)
+			return false;
+
+		immutable_buffer body;
+		if (total_len > 0)
+		{
+			char* buff = body.assign(total_len);
+			for (size_t i = 0; i < num; ++i)
+				if (NULL != pstr[i])
+				{
+					memcpy(buff, pstr[i], len[i]);
+					buff += len[i];
+				}
+		}
+
+		return pack_msg(msg, &body, 1, native);
+	}
+
+	//fragments are reference-counted, they will be released after been sent.
+	bool pack_msg(msg_type& msg, const immutable_buffer bodies[], size_t num, bool native = false)
+	{
+		size_t total_len = 0;
+		for (size_t i = 0; i < num; ++i)
+			total_len += bodies[i].size();
+
+		if (!prepare_msg(msg, total_len, native))
+			return false;
+
+		for (size_t i = 0; i < num; ++i)
+			if (!msg.add_fragment(bodies[i]))
+				return fragment_overflow(msg);
+
+		return true;
+	}
+	bool pack_msg(msg_type& msg, const immutable_buffer& body, bool native = false) {return pack_msg(msg, &body, 1, native);}
+
+	//fragments are caller-owned, they must be kept valid until the message has been sent (see on_msg_send and on_all_msg_send).
+	bool pack_ref_msg(msg_type& msg, const char* const pstr[], const size_t len[], size_t num, bool native = false)
+	{
+		size_t total_len = packer_helper::msg_size_check(0, pstr, len, num);
+		if ((size_t) -1 == total_len || !prepare_msg(msg, total_len, native))
+			return false;
+
+		for (size_t i = 0; i < num; ++i)
+			if (!msg.add_fragment(pstr[i], len[i]))
+				return fragment_overflow(msg);
+
+		return true;
+	}
+	bool pack_ref_msg(msg_type& msg, const char* pstr, size_t len, bool native = false) {return pack_ref_msg(msg, &pstr, &len, 1, native);}
+
+	virtual bool pack_heartbeat(msg_type& msg)
+	{
+		ST_ASIO_HEAD_TYPE head_len = ST_ASIO_HEAD_LEN;
+		head_len = ST_ASIO_HEAD_H2N(head_len);
+		msg.clear();
+		msg.set_head(&head_len, ST_ASIO_HEAD_LEN);
+
+		return true;
+	}
+
+private:
+	//clear msg and set its header according to body_len.
+	static bool prepare_msg(msg_type& msg, size_t body_len, bool native)
+	{
+		msg.clear();
+		if (0 == body_len)
+			return true;
+
+		size_t total_len = (native ? 0 : ST_ASIO_HEAD_LEN) + body_len;
+		if (total_len > ST_ASIO_MSG_BUFFER_SIZE)
+		{
+			unified_out::error_out("pack msg error: length exceeded the ST_ASIO_MSG_BUFFER_SIZE!");
+			return false;
+		}
+		else if (!native)
+		{
+			ST_ASIO_HEAD_TYPE head_len = (ST_ASIO_HEAD_TYPE) total_len;
+			if (total_len != head_len)
+			{
+				unified_out::error_out("pack msg error: length exceeded the header's range!");
+				return false;
+			}
+
+			head_len = ST_ASIO_HEAD_H2N(head_len);
+			msg.set_head(&head_len, ST_ASIO_HEAD_LEN);
+		}
+
+		return true;
+	}
+
+	static bool fragment_overflow(msg_type& msg)
+	{
+		msg.clear();
+		unified_out::error_out("pack msg error: too many fragments, see macro ST_ASIO_MAX_GATHER_FRAGMENT_NUM!");
+		return false;
+	}
+};
+
 //protocol: fixed length
 class fixed_length_packer : public packer
 {
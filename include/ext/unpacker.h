@@ -127,6 +127,251 @@ protected:
 	size_t remain_len; //half-baked msg
 };
 
+//protocol: length + body
+//same protocol as unpacker, but raw_buff is used as a ring buffer, so the half-baked msg will never be moved to the beginning of raw_buff,
+//and if ST_ASIO_SCATTERED_RECV_BUFFER been defined, prepare_next_recv will return two buffers when the free space wraps around, then
+//asio can fill all free space in one read. msgs which straddle the wrap point will be appended to the output msg in two pieces.
+class ring_unpacker : public tcp::i_unpacker<std::string>
+{
+public:
+	ring_unpacker() {reset();}
+	size_t current_msg_length() const {return cur_msg_len;} //current msg's total length, -1 means not available
+
+public:
+	virtual void reset() {cur_msg_len = -1; head = remain_len = 0;}
+	virtual bool parse_msg(size_t bytes_transferred, container_type& msg_can)
+	{
+		//length + msg
+		remain_len += bytes_transferred;
+		assert(remain_len <= ST_ASIO_MSG_BUFFER_SIZE);
+
+		bool got_msg = false, unpack_ok = true;
+		while (unpack_ok) //considering sticky package problem, we need a loop
+			if ((size_t) -1 != cur_msg_len)
+			{
+				if (cur_msg_len > ST_ASIO_MSG_BUFFER_SIZE || cur_msg_len < ST_ASIO_HEAD_LEN)
+					unpack_ok = false;
+				else if (remain_len >= cur_msg_len) //one msg received
+				{
+					got_msg = true;
+					size_t pre_len = stripped() ? ST_ASIO_HEAD_LEN : 0;
+					if (cur_msg_len > pre_len) //exclude heartbeat
+					{
+						msg_can.emplace_back();
+						copy_out(msg_can.back(), head + pre_len, cur_msg_len - pre_len);
+					}
+					remain_len -= cur_msg_len;
+					head = (head + cur_msg_len) % ST_ASIO_MSG_BUFFER_SIZE;
+					cur_msg_len = -1;
+				}
+				else
+					break;
+			}
+			else if (remain_len >= ST_ASIO_HEAD_LEN) //the msg's head been received, sticky package found
+				cur_msg_len = peek_head();
+			else
+				break;
+
+		//we should have at least got one msg, except that the receiving stopped at the end of raw_buff
+		//(without ST_ASIO_SCATTERED_RECV_BUFFER, prepare_next_recv cannot provide the wrapped free space).
+		if (!got_msg && 0 != (head + remain_len) % ST_ASIO_MSG_BUFFER_SIZE)
+			unpack_ok = false;
+		else if (0 == remain_len)
+			head = 0; //make the free space contiguous again, this costs nothing
+
+		//if unpacking failed, successfully parsed msgs will still returned via msg_can(sticky package), please note.
+		return unpack_ok;
+	}
+
+	//a return value of 0 indicates that the read operation is complete. a non-zero value indicates the maximum number
+	//of bytes to be read on the next call to the stream's async_read_some function. ---boost::asio::async_read
+	//read as many as possible to reduce asynchronous call-back, and don't forget to handle sticky package carefully in parse_msg function.
+	virtual size_t completion_condition(const boost::system::error_code& ec, size_t bytes_transferred)
+	{
+		if (ec)
+			return 0;
+
+		size_t data_len = remain_len + bytes_transferred;
+		assert(data_len <= ST_ASIO_MSG_BUFFER_SIZE);
+
+		if ((size_t) -1 == cur_msg_len && data_len >= ST_ASIO_HEAD_LEN) //the msg's head been received
+		{
+			cur_msg_len = peek_head();
+			if (cur_msg_len > ST_ASIO_MSG_BUFFER_SIZE || cur_msg_len < ST_ASIO_HEAD_LEN) //invalid msg, stop reading
+				return 0;
+		}
+
+		return data_len >= cur_msg_len ? 0 : boost::asio::detail::default_max_transfer_size;
+		//read as many as possible except that we have already got an entire msg
+	}
+
+	virtual buffer_type prepare_next_recv()
+	{
+		assert(remain_len < ST_ASIO_MSG_BUFFER_SIZE);
+
+		size_t tail = (head + remain_len) % ST_ASIO_MSG_BUFFER_SIZE;
+		size_t free_len = ST_ASIO_MSG_BUFFER_SIZE - remain_len;
+		size_t first_len = std::min(free_len, ST_ASIO_MSG_BUFFER_SIZE - tail);
+#ifdef ST_ASIO_SCATTERED_RECV_BUFFER
+		buffer_type buffers(1, boost::asio::buffer(boost::next(raw_buff.begin(), tail), first_len));
+		if (free_len > first_len) //free space wraps around
+			buffers.push_back(boost::asio::buffer(raw_buff.begin(), free_len - first_len));
+		return buffers;
+#else
+		return boost::asio::buffer(boost::next(raw_buff.begin(), tail), first_len);
+#endif
+	}
+
+private:
+	size_t peek_head() const
+	{
+		ST_ASIO_HEAD_TYPE head_len;
+		copy_out((char*) &head_len, head, ST_ASIO_HEAD_LEN);
+		return ST_ASIO_HEAD_N2H(head_len);
+	}
+
+	//copy len bytes begin at pos (which can exceed the end of raw_buff) of the ring buffer, it may be split into two pieces.
+	void copy_out(char* buff, size_t pos, size_t len) const
+	{
+		pos %= ST_ASIO_MSG_BUFFER_SIZE;
+		size_t first_len = std::min(len, ST_ASIO_MSG_BUFFER_SIZE - pos);
+		memcpy(buff, boost::next(raw_buff.begin(), pos), first_len);
+		memcpy(boost::next(buff, first_len), raw_buff.begin(), len - first_len);
+	}
+
+	void copy_out(std::string& msg, size_t pos, size_t len) const
+	{
+		pos %= ST_ASIO_MSG_BUFFER_SIZE;
+		size_t first_len = std::min(len, ST_ASIO_MSG_BUFFER_SIZE - pos);
+		msg.reserve(len);
+		msg.assign(boost::next(raw_buff.begin(), pos), first_len);
+		msg.append(raw_buff.begin(), len - first_len);
+	}
+
+protected:
+	boost::array<char, ST_ASIO_MSG_BUFFER_SIZE> raw_buff;
+	size_t cur_msg_len; //-1 means head not received, so msg length is not available.
+	size_t head; //where the half-baked msg begins
+	size_t remain_len; //half-baked msg
+};
+
+//protocol: length + body
+//msgs are slab_buffers which refer to the receiving slab directly, so no memory allocation nor replication per msg.
+//only when the left space of the slab cannot hold the biggest msg, the half-baked msg will be moved to the beginning of the slab
+//(if no slab_buffer refers to it), or be copied to a new slab, so a bigger slab_size means less allocations.
+//slab_size must be at least twice of ST_ASIO_MSG_BUFFER_SIZE, otherwise every receiving will cause above relocation.
+class slab_unpacker : public tcp::i_unpacker<slab_buffer>
+{
+public:
+	slab_unpacker(size_t _slab_size = 16 * ST_ASIO_MSG_BUFFER_SIZE) : slab_size(std::max(_slab_size, (size_t) 2 * ST_ASIO_MSG_BUFFER_SIZE)) {reset();}
+	size_t current_msg_length() const {return cur_msg_len;} //current msg's total length, -1 means not available
+
+public:
+	virtual void reset() {slab.reset(); cur_msg_len = -1; begin = remain_len = 0;}
+	virtual bool parse_msg(size_t bytes_transferred, container_type& msg_can)
+	{
+		//length + msg
+		remain_len += bytes_transferred;
+		assert(slab && begin + remain_len <= slab_size);
+
+		const char* pbegin = boost::next(slab.get(), begin);
+		const char* pnext = pbegin;
+		bool unpack_ok = true;
+		while (unpack_ok) //considering sticky package problem, we need a loop
+			if ((size_t) -1 != cur_msg_len)
+			{
+				if (cur_msg_len > ST_ASIO_MSG_BUFFER_SIZE || cur_msg_len < ST_ASIO_HEAD_LEN)
+					unpack_ok = false;
+				else if (remain_len >= cur_msg_len) //one msg received
+				{
+					if (!stripped())
+						msg_can.emplace_back(slab, pnext, cur_msg_len);
+					else if (cur_msg_len > ST_ASIO_HEAD_LEN) //exclude heartbeat
+						msg_can.emplace_back(slab, boost::next(pnext, ST_ASIO_HEAD_LEN), cur_msg_len - ST_ASIO_HEAD_LEN);
+					remain_len -= cur_msg_len;
+					std::advance(pnext, cur_msg_len);
+					cur_msg_len = -1;
+				}
+				else
+					break;
+			}
+			else if (remain_len >= ST_ASIO_HEAD_LEN) //the msg's head been received, sticky package found
+			{
+				ST_ASIO_HEAD_TYPE head;
+				memcpy(&head, pnext, ST_ASIO_HEAD_LEN);
+				cur_msg_len = ST_ASIO_HEAD_N2H(head);
+			}
+			else
+				break;
+
+		if (pnext == pbegin) //we should have at least got one msg.
+			unpack_ok = false;
+		begin += pnext - pbegin;
+
+		//if unpacking failed, successfully parsed msgs will still returned via msg_can(sticky package), please note.
+		return unpack_ok;
+	}
+
+	//a return value of 0 indicates that the read operation is complete. a non-zero value indicates the maximum number
+	//of bytes to be read on the next call to the stream's async_read_some function. ---boost::asio::async_read
+	//read as many as possible to reduce asynchronous call-back, and don't forget to handle sticky package carefully in parse_msg function.
+	virtual size_t completion_condition(const boost::system::error_code& ec, size_t bytes_transferred)
+	{
+		if (ec)
+			return 0;
+
+		size_t data_len = remain_len + bytes_transferred;
+		assert(begin + data_len <= slab_size);
+
+		if ((size_t) -1 == cur_msg_len && data_len >= ST_ASIO_HEAD_LEN) //the msg's head been received
+		{
+			ST_ASIO_HEAD_TYPE head;
+			memcpy(&head, boost::next(slab.get(), begin), ST_ASIO_HEAD_LEN);
+			cur_msg_len = ST_ASIO_HEAD_N2H(head);
+			if (cur_msg_len > ST_ASIO_MSG_BUFFER_SIZE || cur_msg_len < ST_ASIO_HEAD_LEN) //invalid msg, stop reading
+				return 0;
+		}
+
+		return data_len >= cur_msg_len ? 0 : boost::asio::detail::default_max_transfer_size;
+		//read as many as possible except that we have already got an entire msg
+	}
+
+	virtual buffer_type prepare_next_recv()
+	{
+		if (!slab)
+			slab.reset(new char[slab_size]);
+		else if (slab_size - begin < ST_ASIO_MSG_BUFFER_SIZE) //cannot hold the biggest msg
+		{
+			char* pbegin = boost::next(slab.get(), begin);
+			if (slab.unique()) //no msgs refer to this slab, reuse it
+				memmove(slab.get(), pbegin, remain_len);
+			else
+			{
+				slab_buffer::slab_type new_slab(new char[slab_size]);
+				memcpy(new_slab.get(), pbegin, remain_len);
+				slab.swap(new_slab);
+			}
+			begin = 0;
+		}
+
+		assert(begin + remain_len < slab_size);
+		char* pnext = boost::next(slab.get(), begin + remain_len);
+		size_t free_len = slab_size - begin - remain_len;
+#ifdef ST_ASIO_SCATTERED_RECV_BUFFER
+		return buffer_type(1, boost::asio::buffer(pnext, free_len));
+#else
+		return boost::asio::buffer(pnext, free_len);
+#endif
+	}
+
+protected:
+	slab_buffer::slab_type slab;
+	size_t slab_size;
+	size_t cur_msg_len; //-1 means head not received, so msg length is not available.
+	size_t begin; //where the half-baked msg begins
+	size_t remain_len; //half-baked msg
+};
+
 //protocol: UDP has message boundary, so we don't need a specific protocol to unpack it.
 class udp_unpacker : public udp::i_unpacker<std::string>
 {
@@ -14,12 +14,99 @@
 #define ST_ASIO_OBJECT_H_
 
 #include <boost/function.hpp>
+#include <boost/aligned_storage.hpp>
 
 #include "base.h"
 
 namespace st_asio_wrapper
 {
 
+#if ST_ASIO_HANDLER_MEMORY_SIZE > 0
+//a recycling memory block for handlers of one kind of async operation, only one such operation can be outstanding at a time
+//(like async_read, async_write or msg dispatching of a socket), so no locks are needed. if the block is in use or too small,
+//global heap will be used instead.
+class handler_memory : public boost::noncopyable
+{
+public:
+	handler_memory() : in_use(false) {}
+
+	void* allocate(size_t size)
+	{
+		if (!in_use && size <= sizeof(storage))
+		{
+			in_use = true;
+			return storage.address();
+		}
+
+		return ::operator new(size);
+	}
+
+	void deallocate(void* p) {if (p == storage.address()) in_use = false; else ::operator delete(p);}
+
+private:
+	boost::aligned_storage<ST_ASIO_HANDLER_MEMORY_SIZE> storage;
+	bool in_use;
+};
+
+template<typename T>
+class handler_allocator
+{
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+	template<typename U> struct rebind {typedef handler_allocator<U> other;};
+
+	explicit handler_allocator(handler_memory& mem_) : mem(&mem_) {}
+	template<typename U> handler_allocator(const handler_allocator<U>& other) : mem(other.mem) {}
+
+	T* allocate(size_t n) {return static_cast<T*>(mem->allocate(sizeof(T) * n));}
+	void deallocate(T* p, size_t) {mem->deallocate(p);}
+
+	bool operator==(const handler_allocator& other) const {return mem == other.mem;}
+	bool operator!=(const handler_allocator& other) const {return mem != other.mem;}
+
+	handler_memory* mem;
+};
+
+//hold the handler as is (no boost::function type erasure, no boost::lambda), and allocate asio's operations from handler_memory.
+template<typename Handler>
+class alloc_handler
+{
+public:
+#if BOOST_ASIO_VERSION >= 101100
+	typedef handler_allocator<char> allocator_type;
+	allocator_type get_allocator() const {return allocator_type(*mem);}
+#else
+	friend void* asio_handler_allocate(size_t size, alloc_handler* h) {return h->mem->allocate(size);}
+	friend void asio_handler_deallocate(void* p, size_t, alloc_handler* h) {h->mem->deallocate(p);}
+#endif
+
+#if 0 == ST_ASIO_DELAY_CLOSE && !defined(ST_ASIO_ASYNC_CALL_COUNTER)
+	alloc_handler(handler_memory& mem_, const Handler& handler_, const boost::shared_ptr<char>& indicator_) : mem(&mem_), handler(handler_), indicator(indicator_) {}
+#else
+	alloc_handler(handler_memory& mem_, const Handler& handler_) : mem(&mem_), handler(handler_) {}
+#endif
+
+	void operator()() {handler();}
+	template<typename Arg1> void operator()(const Arg1& arg1) {handler(arg1);}
+	template<typename Arg1, typename Arg2> void operator()(const Arg1& arg1, const Arg2& arg2) {handler(arg1, arg2);}
+
+private:
+	handler_memory* mem;
+	Handler handler;
+#if 0 == ST_ASIO_DELAY_CLOSE && !defined(ST_ASIO_ASYNC_CALL_COUNTER)
+	boost::shared_ptr<char> indicator; //equal to async_call_indicator in object
+#endif
+};
+#else
+class handler_memory {}; //handler memory is disabled, see macro ST_ASIO_HANDLER_MEMORY_SIZE
+#endif
+
 class object
 {
 protected:
@@ -27,8 +114,9 @@ protected:
 
 public:
 	bool stopped() const {return io_context_.stopped();}
+	boost::asio::io_context& get_io_context() {return io_context_;}
 
-#if 0 == ST_ASIO_DELAY_CLOSE
+#if 0 == ST_ASIO_DELAY_CLOSE && !defined(ST_ASIO_ASYNC_CALL_COUNTER)
 	typedef boost::function<void(const boost::system::error_code&)> handler_with_error;
 	typedef boost::function<void(const boost::system::error_code&, size_t)> handler_with_error_size;
 
@@ -43,6 +131,16 @@ public:
 	handler_with_error_size make_handler_error_size(const handler_with_error_size& handler) const
 		{return (async_call_indicator, boost::lambda::bind(boost::lambda::unlambda(handler), boost::lambda::_1, boost::lambda::_2));}
 
+	#if ST_ASIO_HANDLER_MEMORY_SIZE > 0
+	template<typename F> void post(handler_memory& mem, const F& handler) {do_post(alloc_handler<F>(mem, handler, async_call_indicator));}
+	template<typename F> alloc_handler<F> make_handler_error(handler_memory& mem, const F& f) const {return alloc_handler<F>(mem, f, async_call_indicator);}
+	template<typename F> alloc_handler<F> make_handler_error_size(handler_memory& mem, const F& f) const {return alloc_handler<F>(mem, f, async_call_indicator);}
+	#else
+	void post(handler_memory&, const boost::function<void()>& handler) {post(handler);}
+	handler_with_error make_handler_error(handler_memory&, const handler_with_error& handler) const {return make_handler_error(handler);}
+	handler_with_error_size make_handler_error_size(handler_memory&, const handler_with_error_size& handler) const {return make_handler_error_size(handler);}
+	#endif
+
 	bool is_async_calling() const {return !async_call_indicator.unique();}
 	bool is_last_async_call() const {return async_call_indicator.use_count() <= 2;} //can only be called in callbacks
 	inline void set_async_calling(bool) {}
@@ -50,6 +148,84 @@ public:
 protected:
 	object(boost::asio::io_context& _io_context_) : async_call_indicator(boost::make_shared<char>('\0')), io_context_(_io_context_) {}
 	boost::shared_ptr<char> async_call_indicator;
+#elif 0 == ST_ASIO_DELAY_CLOSE
+	//count async calls with one atomic counter, the handler increases it when created and decreases it after been invoked (copies of
+	//the handler don't touch it), this is much cheaper than copying a shared_ptr into every handler (and every copy of it).
+	//the async call belongs to the newest copy (which will be invoked by asio), if it's destroyed without being invoked (the io_context
+	//been stopped or the operation been destroyed), the async call ends in its destructor.
+	template<typename Handler>
+	class tracked_handler
+	{
+	public:
+		tracked_handler(object& owner_, const Handler& handler_) : owner(&owner_), handler(handler_), armed(true) {owner->async_call_begin();}
+		tracked_handler(const tracked_handler& other) : owner(other.owner), handler(other.handler), armed(other.armed) {other.armed = false;}
+		~tracked_handler() {end();}
+
+		void operator()() {end_guard guard(*this); handler();}
+		template<typename Arg1> void operator()(const Arg1& arg1) {end_guard guard(*this); handler(arg1);}
+		template<typename Arg1, typename Arg2> void operator()(const Arg1& arg1, const Arg2& arg2) {end_guard guard(*this); handler(arg1, arg2);}
+
+	private:
+		tracked_handler& operator=(const tracked_handler&); //not implemented, the async call can not be shared
+
+		void end() {if (armed) {armed = false; owner->async_call_end();}}
+
+		struct end_guard
+		{
+			end_guard(tracked_handler& h_) : h(h_) {}
+			~end_guard() {h.end();}
+
+			tracked_handler& h;
+		};
+
+		object* owner;
+		Handler handler;
+		mutable bool armed;
+	};
+
+	#if BOOST_ASIO_VERSION >= 101100
+	template<typename F> void post(const F& handler) {do_post(tracked_handler<F>(*this, handler));}
+	template<typename F> void defer(const F& handler) {boost::asio::defer(io_context_, tracked_handler<F>(*this, handler));}
+	#else
+	template<typename F> void post(const F& handler) {do_post(tracked_handler<F>(*this, handler));}
+	#endif
+
+	template<typename F> tracked_handler<F> make_handler_error(const F& f) {return tracked_handler<F>(*this, f);}
+	template<typename F> tracked_handler<F> make_handler_error_size(const F& f) {return tracked_handler<F>(*this, f);}
+
+	#if ST_ASIO_HANDLER_MEMORY_SIZE > 0
+	template<typename F> void post(handler_memory& mem, const F& handler) {do_post(alloc_handler<tracked_handler<F> >(mem, tracked_handler<F>(*this, handler)));}
+	template<typename F> alloc_handler<tracked_handler<F> > make_handler_error(handler_memory& mem, const F& f)
+		{return alloc_handler<tracked_handler<F> >(mem, tracked_handler<F>(*this, f));}
+	template<typename F> alloc_handler<tracked_handler<F> > make_handler_error_size(handler_memory& mem, const F& f)
+		{return alloc_handler<tracked_handler<F> >(mem, tracked_handler<F>(*this, f));}
+	#else
+	template<typename F> void post(handler_memory&, const F& handler) {post(handler);}
+	template<typename F> tracked_handler<F> make_handler_error(handler_memory&, const F& f) {return make_handler_error(f);}
+	template<typename F> tracked_handler<F> make_handler_error_size(handler_memory&, const F& f) {return make_handler_error_size(f);}
+	#endif
+
+	bool is_async_calling() const {return async_calling || async_call_num.load(boost::memory_order_acquire) > 0;}
+	bool is_last_async_call() const {return async_call_num.load(boost::memory_order_acquire) <= 1;} //can only be called in callbacks
+	inline void set_async_calling(bool value) {async_calling = value;}
+
+protected:
+	object(boost::asio::io_context& _io_context_) : async_calling(false), io_context_(_io_context_)
+		{async_call_num.store(0, boost::memory_order_relaxed); watching.store(0, boost::memory_order_relaxed);}
+
+	//after watch_async_call(), on_all_async_call_end() will be called (only once) as soon as the async call number drops to zero.
+	//watch_async_call() itself holds an async call, so call async_call_end() after it (maybe in another scope),
+	//on_all_async_call_end() may be invoked in the thread which calls async_call_end().
+	void watch_async_call() {async_call_begin(); watching.store(1, boost::memory_order_release);}
+	bool unwatch_async_call() {return 1 == watching.exchange(0, boost::memory_order_acq_rel);} //return true if it was watching
+	bool is_watching_async_call() const {return 1 == watching.load(boost::memory_order_acquire);}
+	virtual void on_all_async_call_end() {}
+
+	void async_call_begin() {async_call_num.fetch_add(1, boost::memory_order_relaxed);}
+	void async_call_end() {if (1 == async_call_num.fetch_sub(1, boost::memory_order_acq_rel) && unwatch_async_call()) on_all_async_call_end();}
+
+	bool async_calling;
+	atomic_size_t async_call_num, watching;
 #else
 	#if BOOST_ASIO_VERSION >= 101100
 	template<typename F> void post(const F& handler) {boost::asio::post(io_context_, handler);}
@@ -61,6 +237,16 @@ protected:
 	template<typename F> inline const F& make_handler_error(const F& f) const {return f;}
 	template<typename F> inline const F& make_handler_error_size(const F& f) const {return f;}
 
+	#if ST_ASIO_HANDLER_MEMORY_SIZE > 0
+	template<typename F> void post(handler_memory& mem, const F& handler) {do_post(alloc_handler<F>(mem, handler));}
+	template<typename F> alloc_handler<F> make_handler_error(handler_memory& mem, const F& f) const {return alloc_handler<F>(mem, f);}
+	template<typename F> alloc_handler<F> make_handler_error_size(handler_memory& mem, const F& f) const {return alloc_handler<F>(mem, f);}
+	#else
+	template<typename F> void post(handler_memory&, const F& handler) {post(handler);}
+	template<typename F> inline const F& make_handler_error(handler_memory&, const F& f) const {return f;}
+	template<typename F> inline const F& make_handler_error_size(handler_memory&, const F& f) const {return f;}
+	#endif
+
 	inline bool is_async_calling() const {return async_calling;}
 	inline bool is_last_async_call() const {return true;}
 	inline void set_async_calling(bool value) {async_calling = value;}
@@ -70,6 +256,14 @@ protected:
 	bool async_calling;
 #endif
 
+#if ST_ASIO_HANDLER_MEMORY_SIZE > 0 || defined(ST_ASIO_ASYNC_CALL_COUNTER)
+	#if BOOST_ASIO_VERSION >= 101100
+	template<typename F> void do_post(const F& handler) {boost::asio::post(io_context_, handler);}
+	#else
+	template<typename F> void do_post(const F& handler) {io_context_.post(handler);}
+	#endif
+#endif
+
 	boost::asio::io_context& io_context_;
 };
 
@@ -29,19 +29,23 @@ public:
 	typedef boost::shared_ptr<Object> object_type;
 	typedef const object_type object_ctype;
 	typedef boost::unordered::unordered_map<boost::uint_fast64_t, object_type> container_type;
+	typedef std::vector<object_type> snapshot_type;
 
 	static const tid TIMER_BEGIN = timer::TIMER_END;
 	static const tid TIMER_FREE_SOCKET = TIMER_BEGIN;
 	static const tid TIMER_CLEAR_SOCKET = TIMER_BEGIN + 1;
+	static const tid TIMER_SWEEP_SOCKET = TIMER_BEGIN + 2;
 	static const tid TIMER_END = TIMER_BEGIN + 10;
 
 protected:
-	object_pool(service_pump& service_pump_) : i_service(service_pump_), timer(service_pump_), cur_id(-1), max_size_(ST_ASIO_MAX_OBJECT_NUM) {}
+	object_pool(service_pump& service_pump_) : i_service(service_pump_), timer(service_pump_), cur_id(-1), object_num(0), max_size_(ST_ASIO_MAX_OBJECT_NUM) {}
 
 	void start()
 	{
 #if !defined(ST_ASIO_REUSE_OBJECT) && !defined(ST_ASIO_RESTORE_OBJECT)
 		set_timer(TIMER_FREE_SOCKET, 1000 * ST_ASIO_FREE_OBJECT_INTERVAL, (boost::lambda::bind(&object_pool::free_object, this, -1), true));
+#elif defined(ST_ASIO_REUSE_OBJECT) && !defined(ST_ASIO_RESTORE_OBJECT)
+		set_timer(TIMER_SWEEP_SOCKET, 1000 * ST_ASIO_SWEEP_OBJECT_INTERVAL, (boost::lambda::bind(&object_pool::sweep_invalid_object, this), true));
 #endif
 #ifdef ST_ASIO_CLEAR_OBJECT_INTERVAL
 		set_timer(TIMER_CLEAR_SOCKET, 1000 * ST_ASIO_CLEAR_OBJECT_INTERVAL, (boost::lambda::bind(&object_pool::clear_obsoleted_object, this), true));
@@ -54,24 +58,34 @@ protected:
 	{
 		assert(object_ptr && !object_ptr->is_equal_to(-1));
 
-		boost::lock_guard<boost::mutex> lock(object_can_mutex);
-		return object_can.size() < max_size_ ? object_can.emplace(object_ptr->id(), object_ptr).second : false;
+		if (object_num.fetch_add(1, boost::memory_order_relaxed) < max_size_)
+		{
+			object_shard& shard = get_shard(object_ptr->id());
+			boost::lock_guard<boost::mutex> lock(shard.object_can_mutex);
+			if (shard.object_can.emplace(object_ptr->id(), object_ptr).second)
+				return true;
+		}
+
+		object_num.fetch_sub(1, boost::memory_order_relaxed);
+		return false;
 	}
 
-	//only add object_ptr to invalid_object_can when it's in object_can, this can avoid duplicated items in invalid_object_can, because invalid_object_can is a list,
-	//there's no way to check the existence of an item in a list efficiently.
+	//only add object_ptr to invalid_object_can when it's in object_can, this can avoid duplicated items in invalid_object_can.
 	bool del_object(object_ctype& object_ptr)
 	{
 		assert(object_ptr);
 
-		boost::unique_lock<boost::mutex> lock(object_can_mutex);
-		bool exist = object_can.erase(object_ptr->id()) > 0;
+		object_shard& shard = get_shard(object_ptr->id());
+		boost::unique_lock<boost::mutex> lock(shard.object_can_mutex);
+		bool exist = shard.object_can.erase(object_ptr->id()) > 0;
 		lock.unlock();
 
 		if (exist)
 		{
-			boost::lock_guard<boost::mutex> lock(invalid_object_can_mutex);
-			invalid_object_can.emplace_back(object_ptr);
+			object_num.fetch_sub(1, boost::memory_order_relaxed);
+
+			boost::lock_guard<boost::mutex> lock(shard.invalid_object_can_mutex);
+			shard.invalid_object_push_(object_ptr);
 		}
 
 		return exist;
@@ -105,10 +119,27 @@ protected:
 		{
 			assert(!find(id));
 
-			boost::lock_guard<boost::mutex> lock(object_can_mutex);
-			object_can.erase(object_ptr->id());
-			object_ptr->id(id);
-			object_can.emplace(id, object_ptr); //must succeed
+			object_shard& old_shard = get_shard(object_ptr->id());
+			object_shard& new_shard = get_shard(id);
+			if (&old_shard == &new_shard)
+			{
+				boost::lock_guard<boost::mutex> lock(new_shard.object_can_mutex);
+				if (0 == new_shard.object_can.erase(object_ptr->id()))
+					object_num.fetch_add(1, boost::memory_order_relaxed);
+				object_ptr->id(id);
+				new_shard.object_can.emplace(id, object_ptr); //must succeed
+			}
+			else //never hold two shards' locks at the same time
+			{
+				boost::unique_lock<boost::mutex> lock(old_shard.object_can_mutex);
+				if (0 == old_shard.object_can.erase(object_ptr->id()))
+					object_num.fetch_add(1, boost::memory_order_relaxed);
+				lock.unlock();
+
+				object_ptr->id(id);
+				boost::lock_guard<boost::mutex> new_lock(new_shard.object_can_mutex);
+				new_shard.object_can.emplace(id, object_ptr); //must succeed
+			}
 		}
 
 		return old_object_ptr;
@@ -163,86 +194,145 @@ protected:
 	}
 #endif
 
-	object_type create_object() {return create_object(boost::ref(sp));}
+	object_type create_object() {return create_object(boost::ref(sp.assign_io_context()));}
 
 public:
 	//to configure unordered_set(for example, set factor or reserved size), not thread safe, so must be called before service_pump startup.
-	container_type& container() {return object_can;}
+	//every shard has its own container, see macro ST_ASIO_OBJECT_POOL_SHARD_NUM for more details.
+	container_type& container(size_t index = 0) {assert(index < ST_ASIO_OBJECT_POOL_SHARD_NUM); return shards[index].object_can;}
+	static size_t shard_num() {return ST_ASIO_OBJECT_POOL_SHARD_NUM;}
 
 	size_t max_size() const {return max_size_;}
 	void max_size(size_t _max_size) {max_size_ = _max_size;}
 
-	size_t size()
-	{
-		boost::lock_guard<boost::mutex> lock(object_can_mutex);
-		return object_can.size();
-	}
+	//not coherent with add_object and del_object, but needs no locks.
+	size_t size() const {return object_num.load(boost::memory_order_relaxed);}
 
 	object_type find(boost::uint_fast64_t id)
 	{
-		boost::lock_guard<boost::mutex> lock(object_can_mutex);
-		BOOST_AUTO(iter, object_can.find(id));
-		return iter != object_can.end() ? iter->second : object_type();
+		object_shard& shard = get_shard(id);
+		boost::lock_guard<boost::mutex> lock(shard.object_can_mutex);
+		BOOST_AUTO(iter, shard.object_can.find(id));
+		return iter != shard.object_can.end() ? iter->second : object_type();
 	}
 
 	//this method has linear complexity, please note.
 	object_type at(size_t index)
 	{
-		boost::lock_guard<boost::mutex> lock(object_can_mutex);
-		assert(index < object_can.size());
-		return index < object_can.size() ? boost::next(object_can.begin(), index)->second : object_type();
+		for (size_t i = 0; i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i)
+		{
+			object_shard& shard = shards[i];
+			boost::lock_guard<boost::mutex> lock(shard.object_can_mutex);
+			if (index < shard.object_can.size())
+				return boost::next(shard.object_can.begin(), index)->second;
+			index -= shard.object_can.size();
+		}
+
+		assert(false);
+		return object_type();
 	}
 
 	size_t invalid_object_size()
 	{
-		boost::lock_guard<boost::mutex> lock(invalid_object_can_mutex);
-		return invalid_object_can.size();
+		size_t size = 0;
+		for (size_t i = 0; i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i)
+		{
+			boost::lock_guard<boost::mutex> lock(shards[i].invalid_object_can_mutex);
+			size += shards[i].invalid_object_index.size();
+		}
+
+		return size;
 	}
 
-	//this method has linear complexity, please note.
 	object_type invalid_object_find(boost::uint_fast64_t id)
 	{
-		boost::lock_guard<boost::mutex> lock(invalid_object_can_mutex);
-		BOOST_AUTO(iter, std::find_if(invalid_object_can.begin(), invalid_object_can.end(), boost::bind(&Object::is_equal_to, _1, id)));
-		return iter == invalid_object_can.end() ? object_type() : *iter;
+		object_shard& shard = get_shard(id);
+		boost::lock_guard<boost::mutex> lock(shard.invalid_object_can_mutex);
+		BOOST_AUTO(iter, shard.invalid_object_index.find(id));
+		return iter == shard.invalid_object_index.end() ? object_type() : *iter->second.iter;
 	}
 
 	//this method has linear complexity, please note.
 	object_type invalid_object_at(size_t index)
 	{
-		boost::lock_guard<boost::mutex> lock(invalid_object_can_mutex);
-		assert(index < invalid_object_can.size());
-		return index < invalid_object_can.size() ? *boost::next(invalid_object_can.begin(), index) : object_type();
+		for (size_t i = 0; i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i)
+		{
+			object_shard& shard = shards[i];
+			boost::lock_guard<boost::mutex> lock(shard.invalid_object_can_mutex);
+			if (index < shard.free_object_can.size())
+				return *boost::next(shard.free_object_can.begin(), index);
+			index -= shard.free_object_can.size();
+			if (index < shard.invalid_object_can.size())
+				return *boost::next(shard.invalid_object_can.begin(), index);
+			index -= shard.invalid_object_can.size();
+		}
+
+		assert(false);
+		return object_type();
 	}
 
-	//this method has linear complexity, please note.
 	object_type invalid_object_pop(boost::uint_fast64_t id)
 	{
-		boost::lock_guard<boost::mutex> lock(invalid_object_can_mutex);
-		BOOST_AUTO(iter, std::find_if(invalid_object_can.begin(), invalid_object_can.end(), boost::bind(&Object::is_equal_to, _1, id)));
-		if (iter != invalid_object_can.end() && (*iter).unique() && (*iter)->obsoleted())
-		{
-			BOOST_AUTO(object_ptr, *iter);
-			invalid_object_can.erase(iter);
-			return object_ptr;
-		}
-		return object_type();
+		object_shard& shard = get_shard(id);
+		boost::lock_guard<boost::mutex> lock(shard.invalid_object_can_mutex);
+		BOOST_AUTO(iter, shard.invalid_object_index.find(id));
+		return iter != shard.invalid_object_index.end() && is_reusable(*iter->second.iter) ? shard.invalid_object_erase_(iter) : object_type();
 	}
 
-	//this method has linear complexity, please note.
+	//objects in free_object_can are taken first, if none of them can be reused, try the oldest object in invalid_object_can (and move it to the tail
+	// if it still cannot be reused), so, at most one object in invalid_object_can will be checked for each shard, others will be checked by
+	// sweep_invalid_object (periodically if ST_ASIO_REUSE_OBJECT been defined, see ST_ASIO_SWEEP_OBJECT_INTERVAL macro).
 	object_type invalid_object_pop()
 	{
-		boost::lock_guard<boost::mutex> lock(invalid_object_can_mutex);
-		for (BOOST_AUTO(iter, invalid_object_can.begin()); iter != invalid_object_can.end(); ++iter)
-			if ((*iter).unique() && (*iter)->obsoleted())
+		for (size_t i = 0; i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i)
+		{
+			object_shard& shard = shards[i];
+			boost::lock_guard<boost::mutex> lock(shard.invalid_object_can_mutex);
+			while (!shard.free_object_can.empty())
 			{
-				BOOST_AUTO(object_ptr, *iter);
-				invalid_object_can.erase(iter);
-				return object_ptr;
+				BOOST_AUTO(iter, shard.invalid_object_index.find(shard.free_object_can.front()->id()));
+				if (is_reusable(shard.free_object_can.front()))
+					return shard.invalid_object_erase_(iter);
+
+				shard.invalid_object_demote_(iter); //additional reference been taken (by invalid_object_find for example)
 			}
+
+			if (!shard.invalid_object_can.empty())
+			{
+				BOOST_AUTO(iter, shard.invalid_object_index.find(shard.invalid_object_can.front()->id()));
+				if (is_reusable(shard.invalid_object_can.front()))
+					return shard.invalid_object_erase_(iter);
+
+				shard.invalid_object_can.splice(shard.invalid_object_can.end(), shard.invalid_object_can, shard.invalid_object_can.begin());
+			}
+		}
+
 		return object_type();
 	}
 
+	//move reusable objects from invalid_object_can to free_object_can, objects in free_object_can are not checked again.
+	//return affected object number.
+	size_t sweep_invalid_object()
+	{
+		size_t num_affected = 0;
+		for (size_t i = 0; i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i)
+		{
+			object_shard& shard = shards[i];
+			boost::lock_guard<boost::mutex> lock(shard.invalid_object_can_mutex);
+			for (BOOST_AUTO(iter, shard.invalid_object_can.begin()); iter != shard.invalid_object_can.end();)
+				if (is_reusable(*iter))
+				{
+					++num_affected;
+					shard.invalid_object_index.find((*iter)->id())->second.ready = true;
+					shard.free_object_can.splice(shard.free_object_can.end(), shard.invalid_object_can, iter++);
+				}
+				else
+					++iter;
+		}
+
+		return num_affected;
+	}
+
 	//Kick out obsoleted objects
 	//Consider the following assumptions:
 	//1.You didn't invoke del_object in on_recv_error or other places.
@@ -250,28 +340,37 @@ public:
 	//object_pool will automatically invoke this function if ST_ASIO_CLEAR_OBJECT_INTERVAL been defined
 	size_t clear_obsoleted_object()
 	{
-		BOOST_TYPEOF(invalid_object_can) objects;
-
-		boost::unique_lock<boost::mutex> lock(object_can_mutex);
-		for (BOOST_AUTO(iter, object_can.begin()); iter != object_can.end();)
-			if (iter->second->obsoleted())
+		size_t size = 0;
+		for (size_t i = 0; i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i)
+		{
+			object_shard& shard = shards[i];
+			boost::container::list<object_type> objects;
+
+			boost::unique_lock<boost::mutex> lock(shard.object_can_mutex);
+			for (BOOST_AUTO(iter, shard.object_can.begin()); iter != shard.object_can.end();)
+				if (iter->second->obsoleted())
+				{
+					objects.emplace_back(iter->second);
+					iter = shard.object_can.erase(iter);
+				}
+				else
+					++iter;
+			lock.unlock();
+
+			if (!objects.empty())
 			{
-				objects.emplace_back(iter->second);
-				iter = object_can.erase(iter);
+				size += objects.size();
+				object_num.fetch_sub(objects.size(), boost::memory_order_relaxed);
+
+				boost::lock_guard<boost::mutex> lock(shard.invalid_object_can_mutex);
+				for (BOOST_AUTO(iter, objects.begin()); iter != objects.end(); ++iter)
+					shard.invalid_object_push_(*iter);
 			}
-			else
-				++iter;
-		lock.unlock();
+		}
 
-		size_t size = objects.size();
 		if (0 != size)
-		{
 			unified_out::warning_out(ST_ASIO_SF " object(s) been kicked out!", size);
 
-			boost::lock_guard<boost::mutex> lock(invalid_object_can_mutex);
-			invalid_object_can.splice(invalid_object_can.end(), objects);
-		}
-
 		return size;
 	}
 
@@ -285,17 +384,29 @@ public:
 	{
 		size_t num_affected = 0;
 
-		boost::unique_lock<boost::mutex> lock(invalid_object_can_mutex);
-		for (BOOST_AUTO(iter, invalid_object_can.begin()); num > 0 && iter != invalid_object_can.end();)
-			if ((*iter)->obsoleted())
+		for (size_t i = 0; num > 0 && i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i)
+		{
+			object_shard& shard = shards[i];
+			boost::container::list<object_type> objects; //free objects out of the lock
+
+			boost::unique_lock<boost::mutex> lock(shard.invalid_object_can_mutex);
+			for (; num > 0 && !shard.free_object_can.empty(); --num, ++num_affected) //already obsoleted
 			{
-				--num;
-				++num_affected;
-				iter = invalid_object_can.erase(iter);
+				shard.invalid_object_index.erase(shard.free_object_can.front()->id());
+				objects.splice(objects.end(), shard.free_object_can, shard.free_object_can.begin());
 			}
-			else
-				++iter;
-		lock.unlock();
+
+			for (BOOST_AUTO(iter, shard.invalid_object_can.begin()); num > 0 && iter != shard.invalid_object_can.end();)
+				if ((*iter)->obsoleted())
+				{
+					--num;
+					++num_affected;
+					shard.invalid_object_index.erase((*iter)->id());
+					objects.splice(objects.end(), shard.invalid_object_can, iter++);
+				}
+				else
+					++iter;
+		}
 
 		if (num_affected > 0)
 			unified_out::warning_out(ST_ASIO_SF " object(s) been freed!", num_affected);
@@ -306,26 +417,201 @@ public:
 	void list_all_object() {do_something_to_all(boost::bind(&Object::show_info, _1, "", ""));}
 	statistic get_statistic() {statistic stat; do_something_to_all(stat += boost::lambda::bind(&Object::get_statistic, *boost::lambda::_1)); return stat;}
 
+	//shards are visited one by one, only one shard is locked at any time.
 	template<typename _Predicate> void do_something_to_all(const _Predicate& __pred)
-		{boost::lock_guard<boost::mutex> lock(object_can_mutex); for (BOOST_AUTO(iter, object_can.begin()); iter != object_can.end(); ++iter) __pred(iter->second);}
+		{for (size_t i = 0; i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i) do_something_to_shard(i, __pred);}
 
 	template<typename _Predicate> void do_something_to_one(const _Predicate& __pred)
-		{boost::lock_guard<boost::mutex> lock(object_can_mutex); for (BOOST_AUTO(iter, object_can.begin()); iter != object_can.end(); ++iter) if (__pred(iter->second)) break;}
+	{
+		for (size_t i = 0; i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i)
+		{
+			object_shard& shard = shards[i];
+			boost::lock_guard<boost::mutex> lock(shard.object_can_mutex);
+			for (BOOST_AUTO(iter, shard.object_can.begin()); iter != shard.object_can.end(); ++iter) if (__pred(iter->second)) return;
+		}
+	}
+
+	template<typename _Predicate> void do_something_to_shard(size_t index, const _Predicate& __pred)
+	{
+		assert(index < ST_ASIO_OBJECT_POOL_SHARD_NUM);
+		object_shard& shard = shards[index];
+		boost::lock_guard<boost::mutex> lock(shard.object_can_mutex);
+		for (BOOST_AUTO(iter, shard.object_can.begin()); iter != shard.object_can.end(); ++iter) __pred(iter->second);
+	}
+
+	//like do_something_to_all, but shards are visited in parallel (by service threads and the calling thread), so __pred must be thread safe,
+	//and the calling thread will be blocked until all shards have been visited. non-blocking broadcasting (TCP_PARALLEL_BROADCAST_MSG) uses this function.
+	//__pred must not block on service threads (for example, safe_send_msg and sync_send_msg wait for service threads to send messages), or dead lock may occur.
+	//the calling thread never waits for a shard which hasn't been taken by other threads, so it's safe to call this function in service threads.
+	template<typename _Predicate> void parallel_do_something_to_all(const _Predicate& __pred)
+		{parallel_run(shard_job<_Predicate>(*this, __pred), ST_ASIO_OBJECT_POOL_SHARD_NUM);}
+
+	//copy all objects out, only one shard is locked at any time and only for copying smart pointers.
+	void snapshot(snapshot_type& objects)
+	{
+		objects.clear();
+		objects.reserve(size());
+		for (size_t i = 0; i < ST_ASIO_OBJECT_POOL_SHARD_NUM; ++i)
+		{
+			object_shard& shard = shards[i];
+			boost::lock_guard<boost::mutex> lock(shard.object_can_mutex);
+			for (BOOST_AUTO(iter, shard.object_can.begin()); iter != shard.object_can.end(); ++iter)
+				objects.push_back(iter->second);
+		}
+	}
+
+	//like parallel_do_something_to_all, but visit objects in a snapshot (see snapshot function) without any locks, objects are split into chunks
+	//(SNAPSHOT_CHUNK_SIZE objects each), so the visiting is spread over service threads even if there's only one shard.
+	//shared broadcasting (TCP_SHARED_BROADCAST_MSG) uses this function.
+	template<typename _Predicate> void parallel_do_something_to_snapshot(const snapshot_type& objects, const _Predicate& __pred)
+		{parallel_run(snapshot_job<_Predicate>(objects, __pred), (objects.size() + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE);}
+
+protected:
+	//objects are distributed into shards by their ids, every shard has its own containers and mutexes, see macro ST_ASIO_OBJECT_POOL_SHARD_NUM.
+	struct object_shard
+	{
+		container_type object_can;
+		boost::mutex object_can_mutex;
+
+		//because all objects are dynamic created and stored in object_can, maybe when receiving error occur
+		//(you are recommended to delete the object from object_can, for example via i_server::del_socket), some other asynchronous calls are still queued in boost::asio::io_context,
+		//and will be dequeued in the future, we must guarantee these objects not be freed from the heap or reused, so we move these objects from object_can to invalid_object_can,
+		//and free them from the heap or reuse them in the near future.
+		//if ST_ASIO_CLEAR_OBJECT_INTERVAL been defined, clear_obsoleted_object() will be invoked automatically and periodically to move all invalid objects into invalid_object_can.
+		//an invalid object stays in the same shard as it was valid.
+		//invalid objects are split into two lists: invalid_object_can holds objects which may still have async calls or additional references,
+		//free_object_can holds objects which have been found obsoleted and have no additional reference (so ready for reusing and freeing),
+		//invalid_object_index locates any of them by id in constant time.
+		typedef boost::container::list<object_type> object_list;
+		struct invalid_object_node
+		{
+			typename object_list::iterator iter;
+			bool ready; //true means in free_object_can, otherwise in invalid_object_can
+		};
+		typedef boost::unordered::unordered_map<boost::uint_fast64_t, invalid_object_node> index_type;
+
+		object_list invalid_object_can, free_object_can;
+		index_type invalid_object_index;
+		boost::mutex invalid_object_can_mutex;
+
+		//following functions must be invoked with invalid_object_can_mutex been locked.
+		void invalid_object_push_(object_ctype& object_ptr)
+		{
+			invalid_object_node node = {invalid_object_can.insert(invalid_object_can.end(), object_ptr), false};
+			bool succ = invalid_object_index.emplace(object_ptr->id(), node).second;
+			assert(succ); (void) succ;
+		}
+
+		object_type invalid_object_erase_(typename index_type::iterator iter)
+		{
+			object_type object_ptr;
+			object_ptr.swap(*iter->second.iter);
+			(iter->second.ready ? free_object_can : invalid_object_can).erase(iter->second.iter);
+			invalid_object_index.erase(iter);
+
+			return object_ptr;
+		}
+
+		void invalid_object_demote_(typename index_type::iterator iter)
+		{
+			assert(iter->second.ready);
+			iter->second.ready = false;
+			invalid_object_can.splice(invalid_object_can.end(), free_object_can, iter->second.iter);
+		}
+	};
+
+	static bool is_reusable(object_ctype& object_ptr) {return object_ptr.unique() && object_ptr->obsoleted();}
+
+	object_shard& get_shard(boost::uint_fast64_t id) {return shards[id % ST_ASIO_OBJECT_POOL_SHARD_NUM];}
+
+private:
+	enum {SNAPSHOT_CHUNK_SIZE = 256};
+
+	template<typename _Predicate> struct shard_job
+	{
+		object_pool& pool;
+		const _Predicate& pred;
+
+		shard_job(object_pool& _pool, const _Predicate& _pred) : pool(_pool), pred(_pred) {}
+		void operator()(size_t index) const {pool.do_something_to_shard(index, pred);}
+	};
+
+	template<typename _Predicate> struct snapshot_job
+	{
+		const snapshot_type& objects;
+		const _Predicate& pred;
+
+		snapshot_job(const snapshot_type& _objects, const _Predicate& _pred) : objects(_objects), pred(_pred) {}
+		void operator()(size_t index) const
+		{
+			BOOST_AUTO(end_iter, objects.begin() + std::min(objects.size(), (index + 1) * SNAPSHOT_CHUNK_SIZE));
+			for (BOOST_AUTO(iter, objects.begin() + index * SNAPSHOT_CHUNK_SIZE); iter != end_iter; ++iter)
+				pred(*iter);
+		}
+	};
+
+	//a job is taken by increasing next_job, job (and everything it refers to) will not be accessed after all jobs have been taken,
+	//so it can hold references (parallel_run waits until all taken jobs have been done).
+	template<typename Job> class parallel_task
+	{
+	public:
+		parallel_task(const Job& _job, size_t _job_num) : job(_job), job_num(_job_num), next_job(0), done_num(0) {}
+
+		void run()
+		{
+			for (size_t index; (index = next_job.fetch_add(1, boost::memory_order_relaxed)) < job_num;)
+			{
+				job(index);
+
+				boost::lock_guard<boost::mutex> lock(mutex);
+				if (job_num == ++done_num)
+					cond.notify_all();
+			}
+		}
+
+		void wait() {boost::unique_lock<boost::mutex> lock(mutex); while (done_num < job_num) cond.wait(lock);}
+
+	private:
+		Job job;
+		size_t job_num;
+
+		atomic_size_t next_job;
+		size_t done_num;
+		boost::mutex mutex;
+		boost::condition_variable cond;
+	};
+
+	//helpers are posted to io_contexts (one helper per service thread at most, and only to io_contexts which have service threads),
+	//the calling thread also takes jobs, then waits for jobs taken by helpers.
+	template<typename Job> void parallel_run(const Job& job, size_t job_num)
+	{
+		if (job_num <= 1)
+		{
+			if (1 == job_num)
+				job(0);
+			return;
+		}
+
+		boost::shared_ptr<parallel_task<Job> > task(new parallel_task<Job>(job, job_num));
+		size_t thread_num = (size_t) std::max(sp.service_thread_num(), 1);
+		size_t helper_num = std::min(job_num - 1, thread_num), io_context_num = std::min(sp.io_context_num(), thread_num);
+		for (size_t i = 1; i <= helper_num; ++i)
+#if BOOST_ASIO_VERSION >= 101100
+			boost::asio::post(sp.get_io_context(i % io_context_num), boost::bind(&parallel_task<Job>::run, task));
+#else
+			sp.get_io_context(i % io_context_num).post(boost::bind(&parallel_task<Job>::run, task));
+#endif
+
+		task->run();
+		task->wait();
+	}
 
 protected:
 	atomic_uint_fast64 cur_id;
 
-	container_type object_can;
-	boost::mutex object_can_mutex;
+	object_shard shards[ST_ASIO_OBJECT_POOL_SHARD_NUM];
+	atomic_size_t object_num; //objects in all object_can
 	size_t max_size_;
-
-	//because all objects are dynamic created and stored in object_can, maybe when receiving error occur
-	//(you are recommended to delete the object from object_can, for example via i_server::del_socket), some other asynchronous calls are still queued in boost::asio::io_context,
-	//and will be dequeued in the future, we must guarantee these objects not be freed from the heap or reused, so we move these objects from object_can to invalid_object_can,
-	//and free them from the heap or reuse them in the near future.
-	//if ST_ASIO_CLEAR_OBJECT_INTERVAL been defined, clear_obsoleted_object() will be invoked automatically and periodically to move all invalid objects into invalid_object_can.
-	boost::container::list<object_type> invalid_object_can;
-	boost::mutex invalid_object_can_mutex;
 };
 
 } //namespace
@@ -13,6 +13,12 @@
 #ifndef ST_ASIO_SERVICE_PUMP_H_
 #define ST_ASIO_SERVICE_PUMP_H_
 
+#if ST_ASIO_THREAD_AFFINITY > 0 && defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#include <fstream>
+#endif
+
 #include "base.h"
 
 namespace st_asio_wrapper
@@ -61,7 +67,12 @@ public:
 	typedef const object_type object_ctype;
 	typedef boost::container::list<object_type> container_type;
 
-	service_pump() : started(false)
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+	//this object itself is the first io_context, so io_context_num - 1 extra io_contexts will be created.
+	service_pump(int io_context_num = ST_ASIO_SERVICE_THREAD_NUM) : started(false), next_thread(0), next_io_context(0), usable_num(0)
+#else
+	service_pump() : started(false), next_thread(0)
+#endif
 #ifdef ST_ASIO_DECREASE_THREAD_AT_RUNTIME
 		, real_thread_num(0), del_thread_num(0), del_thread_req(false)
 #endif
@@ -72,8 +83,56 @@ public:
 		, work(boost::make_shared<boost::asio::io_service::work>(boost::ref(*this)))
 #endif
 #endif
-	{}
-	virtual ~service_pump() {stop_service();}
+	{
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+		io_context_can.push_back(this);
+		for (int i = 1; i < io_context_num; ++i)
+			io_context_can.push_back(new boost::asio::io_context());
+		usable_num = io_context_can.size();
+#endif
+#if ST_ASIO_THREAD_AFFINITY > 0
+		cpu_can = get_cpus(ST_ASIO_THREAD_AFFINITY > 1);
+#endif
+	}
+	virtual ~service_pump()
+	{
+		stop_service();
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+		for (size_t i = 1; i < io_context_can.size(); ++i)
+			delete io_context_can[i];
+#endif
+	}
+
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+	size_t io_context_num() const {return io_context_can.size();}
+	boost::asio::io_context& get_io_context(size_t index) {assert(index < io_context_can.size()); return *io_context_can[index];}
+	size_t get_load(size_t index) const {assert(index < io_context_can.size()); return boost::asio::use_service<st_asio_wrapper::io_context_load>(*io_context_can[index]).load();}
+
+	//pick up an io_context for a new object (socket), see macro ST_ASIO_IO_CONTEXT_POOL for more details.
+	//after service threads been created, io_contexts which have no service threads will not be picked up.
+	boost::asio::io_context& assign_io_context()
+	{
+		size_t num = usable_num.load(boost::memory_order_relaxed);
+		size_t index = next_io_context.fetch_add(1, boost::memory_order_relaxed) % num;
+#if ST_ASIO_IO_CONTEXT_POOL > 1
+		size_t min_load = get_load(index);
+		for (size_t i = 1; min_load > 0 && i < num; ++i) //start from the round-robin one, so ties are broken in round-robin
+		{
+			size_t this_index = (index + i) % num, this_load = get_load(this_index);
+			if (this_load < min_load)
+			{
+				index = this_index;
+				min_load = this_load;
+			}
+		}
+#endif
+		return *io_context_can[index];
+	}
+#else
+	size_t io_context_num() const {return 1;}
+	boost::asio::io_context& get_io_context(size_t index) {assert(0 == index); return *this;}
+	boost::asio::io_context& assign_io_context() {return *this;}
+#endif
 
 	object_type find(int id)
 	{
@@ -146,6 +205,7 @@ public:
 	{
 		if (!is_service_started())
 		{
+			next_thread = 1; //current thread is the first service thread (and it will serve the first io_context), it will not be bound to any CPU
 			do_service(thread_num - 1);
 			run();
 			wait_service();
@@ -163,16 +223,29 @@ public:
 			work.reset();
 #endif
 			do_something_to_all(boost::mem_fn(&i_service::stop_service));
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+			works.clear();
+#endif
 		}
 	}
 
 	bool is_running() const {return !stopped();}
 	bool is_service_started() const {return started;}
 
-	void add_service_thread(int thread_num) {for (int i = 0; i < thread_num; ++i) service_threads.create_thread(boost::bind(&service_pump::run, this));}
+	//if io_context pool is enabled, every thread serves only one io_context, io_contexts will be assigned in turn.
+	void add_service_thread(int thread_num)
+	{
+		for (int i = 0; i < thread_num; ++i)
+			service_threads.create_thread(boost::bind(&service_pump::service_thread, this, next_thread.fetch_add(1, boost::memory_order_relaxed)));
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+		usable_num = std::max((size_t) 1, std::min(io_context_can.size(), next_thread.load(boost::memory_order_relaxed)));
+#endif
+	}
 #ifdef ST_ASIO_DECREASE_THREAD_AT_RUNTIME
 	void del_service_thread(int thread_num) {if (thread_num > 0) {del_thread_num.fetch_add(thread_num, boost::memory_order_relaxed); del_thread_req = true;}}
 	int service_thread_num() const {return real_thread_num.load(boost::memory_order_relaxed);}
+#else
+	int service_thread_num() const {return (int) next_thread.load(boost::memory_order_relaxed);}
 #endif
 
 protected:
@@ -185,9 +258,28 @@ protected:
 		restart(); //this is needed when restart service
 #else
 		reset(); //this is needed when restart service
+#endif
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+		//extra io_contexts must not run out of work before any sockets been assigned to them
+		for (size_t i = 1; i < io_context_can.size(); ++i)
+		{
+#if BOOST_ASIO_VERSION >= 101100
+			io_context_can[i]->restart();
+			works.push_back(boost::make_shared<work_type>(io_context_can[i]->get_executor()));
+#else
+			io_context_can[i]->reset();
+			works.push_back(boost::make_shared<work_type>(boost::ref(*io_context_can[i])));
+#endif
+		}
+		//services will create sockets (for example async accepting) before service threads been created
+		usable_num = std::max((size_t) 1, std::min(io_context_can.size(), next_thread.load(boost::memory_order_relaxed) + std::max(thread_num, 0)));
 #endif
 		do_something_to_all(boost::mem_fn(&i_service::start_service));
 		add_service_thread(thread_num);
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+		if (next_thread.load(boost::memory_order_relaxed) < io_context_can.size())
+			unified_out::warning_out("only " ST_ASIO_SF " of " ST_ASIO_SF " io_context(s) have service threads.", next_thread.load(boost::memory_order_relaxed), io_context_can.size());
+#endif
 	}
 
 	void wait_service()
@@ -195,6 +287,10 @@ protected:
 		service_threads.join_all();
 
 		started = false;
+		next_thread = 0;
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+		usable_num = io_context_can.size();
+#endif
 #ifdef ST_ASIO_DECREASE_THREAD_AT_RUNTIME
 		del_thread_num = 0;
 #endif
@@ -210,6 +306,108 @@ protected:
 	}
 	virtual void free(object_type i_service_) {} //if needed, rewrite this to free the service
 
+	//return the CPU which the index-th service thread will be bound to, negative value means don't bind it,
+	//rewrite this to place service threads by yourself, see macro ST_ASIO_THREAD_AFFINITY for more details.
+#if ST_ASIO_THREAD_AFFINITY > 0
+	virtual int thread_cpu(size_t index) {return cpu_can.empty() ? -1 : cpu_can[index % cpu_can.size()];}
+#else
+	virtual int thread_cpu(size_t index) {return -1;}
+#endif
+
+	//bind current thread to the specified CPU
+	static bool bind_cpu(int cpu)
+	{
+#ifdef __linux__
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(cpu, &cpu_set);
+		return 0 == pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#elif defined(_WIN32)
+		return cpu < (int) (8 * sizeof(DWORD_PTR)) && 0 != SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu);
+#else
+		return false;
+#endif
+	}
+
+#if ST_ASIO_THREAD_AFFINITY > 0
+	//all CPUs this process can run on, if interleave, CPUs will be ordered like this: node0's 1st CPU, node1's 1st CPU, node0's 2nd CPU, node1's 2nd CPU...
+	static std::vector<int> get_cpus(bool interleave)
+	{
+		std::vector<std::vector<int> > nodes;
+#ifdef __linux__
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		if (0 != sched_getaffinity(0, sizeof(cpu_set), &cpu_set))
+			return std::vector<int>();
+
+		for (int i = 0; interleave && i < ST_ASIO_MAX_NUMA_NODE_NUM; ++i)
+		{
+			std::stringstream os;
+			os << "/sys/devices/system/node/node" << i << "/cpulist";
+			std::ifstream f(os.str().data());
+			std::string cpu_list;
+			if (!std::getline(f, cpu_list))
+				continue;
+
+			std::vector<int> cpus; //format: 0-3,8-11
+			for (std::stringstream is(cpu_list); std::getline(is, cpu_list, ',');)
+			{
+				int first = -1, last = -1;
+				int n = sscanf(cpu_list.data(), "%d-%d", &first, &last);
+				for (last = 1 == n ? first : last; n > 0 && first <= last; ++first)
+					if (first < CPU_SETSIZE && CPU_ISSET(first, &cpu_set))
+						cpus.push_back(first);
+			}
+			if (!cpus.empty())
+				nodes.push_back(cpus);
+		}
+
+		if (nodes.empty()) //NUMA not available or not wanted
+		{
+			nodes.resize(1);
+			for (int i = 0; i < CPU_SETSIZE; ++i)
+				if (CPU_ISSET(i, &cpu_set))
+					nodes.front().push_back(i);
+		}
+#else
+		nodes.resize(1);
+		for (unsigned i = 0; i < boost::thread::hardware_concurrency(); ++i)
+			nodes.front().push_back((int) i);
+#endif
+
+		std::vector<int> cpus;
+		for (size_t i = 0, n = nodes.size(); n > 0; ++i)
+		{
+			n = 0;
+			for (BOOST_AUTO(iter, nodes.begin()); iter != nodes.end(); ++iter)
+				if (i < iter->size())
+				{
+					cpus.push_back((*iter)[i]);
+					++n;
+				}
+		}
+
+		return cpus;
+	}
+#endif
+
+	void service_thread(size_t index)
+	{
+		int cpu = thread_cpu(index);
+		if (cpu >= 0 && !bind_cpu(cpu))
+			unified_out::warning_out("failed to bind service thread " ST_ASIO_SF " to CPU %d.", index, cpu);
+
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+		index %= io_context_can.size();
+		if (index > 0)
+		{
+			run_io_context(*io_context_can[index]);
+			return;
+		}
+#endif
+		run();
+	}
+
 #ifdef ST_ASIO_ENHANCED_STABILITY
 	virtual bool on_exception(const boost::system::system_error& e)
 	{
@@ -270,6 +468,15 @@ protected:
 #ifdef ST_ASIO_ENHANCED_STABILITY
 	size_t run() {while (true) {try {return boost::asio::io_context::run();} catch (const boost::system::system_error& e) {if (!on_exception(e)) return 0;}}}
 #endif
+#endif
+
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+#ifdef ST_ASIO_ENHANCED_STABILITY
+	size_t run_io_context(boost::asio::io_context& io_context_)
+		{while (true) {try {return io_context_.run();} catch (const boost::system::system_error& e) {if (!on_exception(e)) return 0;}}}
+#else
+	size_t run_io_context(boost::asio::io_context& io_context_) {return io_context_.run();}
+#endif
 #endif
 
 	DO_SOMETHING_TO_ALL_MUTEX(service_can, service_can_mutex)
@@ -289,6 +496,21 @@ protected:
 	container_type service_can;
 	boost::mutex service_can_mutex;
 	boost::thread_group service_threads;
+	atomic_size_t next_thread; //the index of next service thread
+#if ST_ASIO_THREAD_AFFINITY > 0
+	std::vector<int> cpu_can;
+#endif
+
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+#if BOOST_ASIO_VERSION >= 101100
+	typedef boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_type;
+#else
+	typedef boost::asio::io_service::work work_type;
+#endif
+	std::vector<boost::asio::io_context*> io_context_can; //the first one is this object itself
+	std::vector<boost::shared_ptr<work_type> > works;
+	atomic_size_t next_io_context, usable_num;
+#endif
 
 #ifdef ST_ASIO_DECREASE_THREAD_AT_RUNTIME
 	atomic_int_fast32_t real_thread_num;
@@ -50,11 +50,18 @@ protected:
 		send_atomic.store(0, boost::memory_order_relaxed);
 		dispatch_atomic.store(0, boost::memory_order_relaxed);
 		start_atomic.store(0, boost::memory_order_relaxed);
+#if ST_ASIO_SEND_LINGER > 0
+		send_byte_num.store(0, boost::memory_order_relaxed);
+#endif
 	}
 
 	void reset()
 	{
+#ifdef ST_ASIO_ASYNC_CALL_COUNTER
+		bool need_clean_up = unwatch_async_call();
+#else
 		bool need_clean_up = is_timer(TIMER_DELAY_CLOSE);
+#endif
 		stop_all_timer(); //just in case, theoretically, timer TIMER_DELAY_CLOSE and TIMER_ASYNC_SHUTDOWN (used by tcp::socket_base) can left behind.
 		if (need_clean_up)
 		{
@@ -75,6 +82,9 @@ protected:
 	{
 		last_dispatch_msg.clear();
 		send_msg_buffer.clear();
+#if ST_ASIO_SEND_LINGER > 0
+		send_byte_num.store(0, boost::memory_order_relaxed);
+#endif
 		recv_msg_buffer.clear();
 		temp_msg_buffer.clear();
 	}
@@ -84,6 +94,7 @@ public:
 	typedef obj_with_begin_time<OutMsgType> out_msg;
 	typedef InQueue<in_msg, InContainer<in_msg> > in_container_type;
 	typedef OutQueue<out_msg, OutContainer<out_msg> > out_container_type;
+	typedef boost::container::list<out_msg> out_msg_batch;
 
 	boost::uint_fast64_t id() const {return _id;}
 	bool is_equal_to(boost::uint_fast64_t id) const {return _id == id;}
@@ -100,11 +111,21 @@ public:
 	bool started() const {return started_;}
 	void start()
 	{
+#ifdef ST_ASIO_ASYNC_CALL_COUNTER
+		if (!started_ && !is_watching_async_call() && !stopped())
+#else
 		if (!started_ && !is_timer(TIMER_DELAY_CLOSE) && !stopped())
+#endif
 		{
 			scope_atomic_lock<> lock(start_atomic);
 			if (!started_ && lock.locked())
+			{
 				started_ = do_start();
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+				if (started_) //only started sockets load the io_context, see io_context_load
+					boost::asio::use_service<io_context_load>(get_io_context()).increase();
+#endif
+			}
 		}
 	}
 
@@ -181,11 +202,25 @@ public:
 	GET_PENDING_MSG_NUM(get_pending_send_msg_num, send_msg_buffer)
 	GET_PENDING_MSG_NUM(get_pending_recv_msg_num, recv_msg_buffer)
 
+#if ST_ASIO_SEND_LINGER > 0
+	void pop_first_pending_send_msg(in_msg& msg) {msg.clear(); if (send_msg_buffer.try_dequeue(msg)) send_byte_num.fetch_sub(msg.size(), boost::memory_order_relaxed);}
+#else
 	POP_FIRST_PENDING_MSG(pop_first_pending_send_msg, send_msg_buffer, in_msg)
+#endif
 	POP_FIRST_PENDING_MSG(pop_first_pending_recv_msg, recv_msg_buffer, out_msg)
 
 	//clear all pending msgs
+#if ST_ASIO_SEND_LINGER > 0
+	void pop_all_pending_send_msg(in_container_type& msg_queue)
+	{
+		msg_queue.clear();
+		send_msg_buffer.swap(msg_queue);
+		for (BOOST_AUTO(iter, msg_queue.begin()); iter != msg_queue.end(); ++iter)
+			send_byte_num.fetch_sub(iter->size(), boost::memory_order_relaxed);
+	}
+#else
 	POP_ALL_PENDING_MSG(pop_all_pending_send_msg, send_msg_buffer, in_container_type)
+#endif
 	POP_ALL_PENDING_MSG(pop_all_pending_recv_msg, recv_msg_buffer, out_container_type)
 
 protected:
@@ -228,6 +263,23 @@ protected:
 	//
 	//notice: the msg is unpacked, using inconstant is for the convenience of swapping
 	virtual bool on_msg(OutMsgType& msg) = 0;
+
+#ifdef ST_ASIO_BATCH_ON_MSG
+	//all msgs got from one receiving will be delivered via one call, handle them from the front and return how many msgs been handled,
+	//the next msg will be treated as on_msg returned false for it (moved into receiving buffer and then be dispatched via on_msg_handle()),
+	//so are the rest msgs, but if congestion control been opened, the rest msgs will be kept and delivered via this function again later.
+	//don't add or erase msgs in msg_can, only swap them out (if you want to keep them) or just read them.
+	//the default implementation calls on_msg one by one until it returns false or congestion control been opened, rewrite it to handle
+	//msgs in batch (for example, one database or cache round-trip for all msgs), this saves per-msg virtual function calls too.
+	virtual size_t on_msgs(out_msg_batch& msg_can)
+	{
+		size_t num = 0;
+		for (BOOST_AUTO(iter, msg_can.begin()); !congestion_controlling && iter != msg_can.end() && on_msg(*iter); ++iter)
+			++num;
+
+		return num;
+	}
+#endif
 #endif
 
 	//handling msg in om_msg_handle() will not block msg receiving on the same socket
@@ -258,6 +310,9 @@ protected:
 			return false;
 
 		started_ = false;
+#if ST_ASIO_IO_CONTEXT_POOL > 0
+		boost::asio::use_service<io_context_load>(get_io_context()).decrease();
+#endif
 		stop_all_timer();
 
 		if (lowest_layer().is_open())
@@ -273,7 +328,13 @@ protected:
 		else
 		{
 			set_async_calling(true);
+#ifdef ST_ASIO_ASYNC_CALL_COUNTER
+			watch_async_call();
+			lock.unlock(); //on_close() may call start()
+			async_call_end(); //on_all_async_call_end() will be called right now or after the last async call finished
+#else
 			set_timer(TIMER_DELAY_CLOSE, ST_ASIO_DELAY_CLOSE * 1000 + 50, boost::bind(&socket::timer_handler, this, _1));
+#endif
 		}
 
 		return true;
@@ -288,11 +349,25 @@ protected:
 		if (!temp_msg_buffer.empty() && !congestion_controlling)
 		{
 			auto_duration(stat.handle_time_1_sum);
+#ifdef ST_ASIO_BATCH_ON_MSG
+			size_t num = std::min(on_msgs(temp_msg_buffer), temp_msg_buffer.size());
+			BOOST_AUTO(end_iter, temp_msg_buffer.begin());
+			std::advance(end_iter, num);
+			temp_msg_buffer.erase(temp_msg_buffer.begin(), end_iter);
+			if (!temp_msg_buffer.empty()) //the first msg has been rejected, it always goes to on_msg_handle(), just like on_msg returned false
+			{
+				if (congestion_controlling) //keep the rest and deliver them via on_msgs again later
+					temp_buffer.splice(temp_buffer.end(), temp_msg_buffer, temp_msg_buffer.begin());
+				else
+					temp_buffer.swap(temp_msg_buffer); //temp_buffer is empty, so this is equal to a splice
+			}
+#else
 			for (BOOST_AUTO(iter, temp_msg_buffer.begin()); !congestion_controlling && iter != temp_msg_buffer.end();)
 				if (on_msg(*iter))
 					temp_msg_buffer.erase(iter++);
 				else
 					temp_buffer.splice(temp_buffer.end(), temp_msg_buffer, iter++);
+#endif
 		}
 #else
 		temp_buffer.swap(temp_msg_buffer);
@@ -334,7 +409,7 @@ protected:
 	{
 		if (!last_dispatch_msg.empty() || recv_msg_buffer.try_dequeue(last_dispatch_msg))
 		{
-			post(boost::bind(&socket::msg_handler, this));
+			post(dispatch_mem, boost::bind(&socket::msg_handler, this));
 			return true;
 		}
 
@@ -349,6 +424,9 @@ protected:
 			do_send_msg(msg);
 		else
 		{
+#if ST_ASIO_SEND_LINGER > 0
+			send_byte_num.fetch_add(msg.size(), boost::memory_order_relaxed); //before enqueuing, so the consumer never makes it underflow
+#endif
 			in_msg unused(msg);
 			send_msg_buffer.enqueue(unused);
 			send_msg();
@@ -390,6 +468,19 @@ private:
 	template<typename Object> friend class object_pool;
 	void id(boost::uint_fast64_t id) {_id = id;}
 
+#ifdef ST_ASIO_ASYNC_CALL_COUNTER
+	virtual void on_all_async_call_end()
+	{
+		if (lowest_layer().is_open())
+		{
+			boost::system::error_code ec;
+			lowest_layer().close(ec);
+		}
+		on_close();
+		set_async_calling(false);
+	}
+#endif
+
 	bool timer_handler(tid id)
 	{
 		switch (id)
@@ -425,27 +516,42 @@ private:
 
 	void msg_handler()
 	{
-		BOOST_AUTO(begin_time, statistic::local_time());
-		stat.dispatch_dealy_sum += begin_time - last_dispatch_msg.begin_time;
-		bool re = on_msg_handle(last_dispatch_msg); //must before next msg dispatching to keep sequence
-		BOOST_AUTO(end_time, statistic::local_time());
-		stat.handle_time_2_sum += end_time - begin_time;
-
-		if (!re) //dispatch failed, re-dispatch
-		{
-			last_dispatch_msg.restart(end_time);
-			dispatching = false;
-			set_timer(TIMER_DISPATCH_MSG, msg_handling_interval_step2_, boost::bind(&socket::timer_handler, this, _1));
-		}
-		else //dispatch msg in sequence
+		++stat.dispatch_batch_sum;
+#if ST_ASIO_DISPATCH_BATCH_DURATION > 0
+		BOOST_AUTO(deadline, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::microseconds(ST_ASIO_DISPATCH_BATCH_DURATION));
+#endif
+		for (size_t num = 1;; ++num) //handle msgs in sequence, at most ST_ASIO_MAX_DISPATCH_BATCH msgs in one post
 		{
-			last_dispatch_msg.clear();
-			if (!do_dispatch_msg())
+			BOOST_AUTO(begin_time, statistic::local_time());
+			stat.dispatch_dealy_sum += begin_time - last_dispatch_msg.begin_time;
+			bool re = on_msg_handle(last_dispatch_msg); //must before next msg dispatching to keep sequence
+			BOOST_AUTO(end_time, statistic::local_time());
+			stat.handle_time_2_sum += end_time - begin_time;
+
+			if (!re) //dispatch failed, re-dispatch
 			{
+				last_dispatch_msg.restart(end_time);
 				dispatching = false;
-				if (!recv_msg_buffer.empty())
-					dispatch_msg(); //just make sure no pending msgs
+				set_timer(TIMER_DISPATCH_MSG, msg_handling_interval_step2_, boost::bind(&socket::timer_handler, this, _1));
+				return;
 			}
+
+			++stat.dispatch_msg_sum;
+			last_dispatch_msg.clear();
+			if (num >= ST_ASIO_MAX_DISPATCH_BATCH
+#if ST_ASIO_DISPATCH_BATCH_DURATION > 0
+				|| boost::posix_time::microsec_clock::universal_time() >= deadline
+#endif
+				|| !recv_msg_buffer.try_dequeue(last_dispatch_msg))
+				break;
+		}
+
+		//dispatch msg in sequence, yield to other handlers between two batches
+		if (!do_dispatch_msg())
+		{
+			dispatching = false;
+			if (!recv_msg_buffer.empty())
+				dispatch_msg(); //just make sure no pending msgs
 		}
 	}
 
@@ -464,6 +570,9 @@ protected:
 
 	volatile bool sending;
 	atomic_size_t send_atomic;
+#if ST_ASIO_SEND_LINGER > 0
+	atomic_size_t send_byte_num; //how many bytes in send_msg_buffer, see macro ST_ASIO_SEND_LINGER
+#endif
 
 	volatile bool dispatching;
 	atomic_size_t dispatch_atomic;
@@ -478,6 +587,8 @@ protected:
 	bool recv_idle_began;
 
 	size_t msg_handling_interval_step1_, msg_handling_interval_step2_;
+
+	handler_memory recv_mem, send_mem, dispatch_mem; //for async_read, async_write and msg dispatching
 };
 
 } //namespace
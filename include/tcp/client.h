@@ -59,8 +59,8 @@ public:
 
 	///////////////////////////////////////////////////
 	//msg sending interface
-	TCP_BROADCAST_MSG(broadcast_msg, send_msg)
-	TCP_BROADCAST_MSG(broadcast_native_msg, send_native_msg)
+	TCP_PARALLEL_BROADCAST_MSG(broadcast_msg, send_msg)
+	TCP_PARALLEL_BROADCAST_MSG(broadcast_native_msg, send_native_msg)
 	//guarantee send msg successfully even if can_overflow equal to false
 	//success at here just means put the msg into tcp::socket_base's send buffer
 	TCP_BROADCAST_MSG(safe_broadcast_msg, safe_send_msg)
@@ -68,6 +68,9 @@ public:
 	//send message with sync mode
 	TCP_BROADCAST_MSG(sync_broadcast_msg, sync_send_msg)
 	TCP_BROADCAST_MSG(sync_broadcast_native_msg, sync_send_native_msg)
+	//pack only once, then share the packed message among all sockets (only for reference counted in_msg_type, see TCP_SHARED_BROADCAST_MSG)
+	TCP_SHARED_BROADCAST_MSG(shared_broadcast_msg, false)
+	TCP_SHARED_BROADCAST_MSG(shared_broadcast_native_msg, true)
 	//msg sending interface
 	///////////////////////////////////////////////////
 
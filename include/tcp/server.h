@@ -15,15 +15,29 @@
 
 #include "../object_pool.h"
 
+#if ST_ASIO_ACCEPTOR_NUM > 1 && !defined(SO_REUSEPORT)
+	#error ST_ASIO_ACCEPTOR_NUM can only be bigger than 1 if SO_REUSEPORT is supported.
+#endif
+
 namespace st_asio_wrapper { namespace tcp {
 
 template<typename Socket, typename Pool = object_pool<Socket>, typename Server = i_server>
 class server_base : public Server, public Pool
 {
 public:
-	server_base(service_pump& service_pump_) : Pool(service_pump_), acceptor(service_pump_) {set_server_addr(ST_ASIO_SERVER_PORT);}
+	server_base(service_pump& service_pump_) : Pool(service_pump_), acceptor(service_pump_) {first_init();}
 	template<typename Arg>
-	server_base(service_pump& service_pump_, const Arg& arg) : Pool(service_pump_, arg), acceptor(service_pump_) {set_server_addr(ST_ASIO_SERVER_PORT);}
+	server_base(service_pump& service_pump_, const Arg& arg) : Pool(service_pump_, arg), acceptor(service_pump_) {first_init();}
+
+	//helper function, just call it in constructor
+	void first_init()
+	{
+		set_server_addr(ST_ASIO_SERVER_PORT);
+#if ST_ASIO_ACCEPTOR_NUM > 1
+		for (size_t i = 1; i < ST_ASIO_ACCEPTOR_NUM; ++i)
+			acceptors.push_back(boost::shared_ptr<boost::asio::ip::tcp::acceptor>(new boost::asio::ip::tcp::acceptor(acceptor_io_context(i))));
+#endif
+	}
 
 	bool set_server_addr(unsigned short port, const std::string& ip = std::string())
 	{
@@ -47,12 +61,78 @@ public:
 	}
 	const boost::asio::ip::tcp::endpoint& get_server_addr() const {return server_addr;}
 
-	void stop_listen() {boost::system::error_code ec; acceptor.cancel(ec); acceptor.close(ec);}
-	bool is_listening() const {return acceptor.is_open();}
+	void stop_listen()
+	{
+		boost::system::error_code ec;
+		for (size_t i = 0; i < ST_ASIO_ACCEPTOR_NUM; ++i)
+		{
+			get_acceptor(i).cancel(ec);
+			get_acceptor(i).close(ec);
+#if ST_ASIO_ACCEPT_BATCH > 0
+			release_spare_socket(i);
+#endif
+		}
+	}
+	bool is_listening() const //any acceptor is listening
+	{
+		for (size_t i = 0; i < ST_ASIO_ACCEPTOR_NUM; ++i)
+			if (get_acceptor(i).is_open())
+				return true;
+
+		return false;
+	}
+
+	//all acceptors listen on the same address (with SO_REUSEPORT), see macro ST_ASIO_ACCEPTOR_NUM for more details.
+	size_t acceptor_num() const {return ST_ASIO_ACCEPTOR_NUM;}
+#if ST_ASIO_ACCEPTOR_NUM > 1
+	boost::asio::ip::tcp::acceptor& get_acceptor(size_t index) {assert(index < ST_ASIO_ACCEPTOR_NUM); return 0 == index ? acceptor : *acceptors[index - 1];}
+	const boost::asio::ip::tcp::acceptor& get_acceptor(size_t index) const {assert(index < ST_ASIO_ACCEPTOR_NUM); return 0 == index ? acceptor : *acceptors[index - 1];}
+#else
+	boost::asio::ip::tcp::acceptor& get_acceptor(size_t index) {assert(0 == index); return acceptor;}
+	const boost::asio::ip::tcp::acceptor& get_acceptor(size_t index) const {assert(0 == index); return acceptor;}
+#endif
+	//acceptors are spread across io_contexts
+	boost::asio::io_context& acceptor_io_context(size_t index) {service_pump& sp = get_service_pump(); return sp.get_io_context(index % sp.io_context_num());}
+
+	//statistic of the specified acceptor
+	//how many connections been accepted (include batch accepting)
+	size_t accept_num(size_t index) const {assert(index < ST_ASIO_ACCEPTOR_NUM); return accept_infos[index].accept_num.load(boost::memory_order_relaxed);}
+	//how many connections been accepted by batch accepting, see macro ST_ASIO_ACCEPT_BATCH for more details.
+	size_t batch_accept_num(size_t index) const {assert(index < ST_ASIO_ACCEPTOR_NUM); return accept_infos[index].batch_accept_num.load(boost::memory_order_relaxed);}
+	//how many sockets are waiting for new connections (outstanding async_accept)
+	size_t pending_accept_num(size_t index) const {assert(index < ST_ASIO_ACCEPTOR_NUM); return accept_infos[index].pending_num.load(boost::memory_order_relaxed);}
+	//wanted number of outstanding async_accept, see macro ST_ASIO_MAX_ASYNC_ACCEPT_NUM for more details.
+	size_t accept_concurrency(size_t index) const {assert(index < ST_ASIO_ACCEPTOR_NUM); return accept_infos[index].concurrency.load(boost::memory_order_relaxed);}
+	//accepted connections in the last whole second.
+	double accept_rate(size_t index) const
+	{
+		assert(index < ST_ASIO_ACCEPTOR_NUM);
+		const acceptor_info& info = accept_infos[index];
+
+		boost::uint_fast64_t now = time(NULL), second = info.rate_second.load(boost::memory_order_relaxed);
+		if (now == second)
+			return (double) info.last_rate_num.load(boost::memory_order_relaxed);
+		else if (now == second + 1)
+			return (double) info.rate_num.load(boost::memory_order_relaxed);
+
+		return .0;
+	}
 
 	//implement i_server's pure virtual functions
 	virtual service_pump& get_service_pump() {return Pool::get_service_pump();}
 	virtual const service_pump& get_service_pump() const {return Pool::get_service_pump();}
+	//with more than one acceptor, a new socket is placed in the io_context of the acceptor which is accepting it (accept handlers of
+	//an acceptor are invoked in its io_context), so the whole connection is served by the same io_context (thread) which accepted it,
+	//otherwise (or in threads which don't serve any acceptors), see service_pump::assign_io_context.
+	virtual boost::asio::io_context& assign_io_context()
+	{
+#if ST_ASIO_ACCEPTOR_NUM > 1 && ST_ASIO_IO_CONTEXT_POOL > 0 && BOOST_ASIO_VERSION >= 101100
+		for (size_t i = 0; i < ST_ASIO_ACCEPTOR_NUM; ++i)
+			if (acceptor_io_context(i).get_executor().running_in_this_thread())
+				return acceptor_io_context(i);
+#endif
+		return get_service_pump().assign_io_context();
+	}
 	virtual bool del_socket(const boost::shared_ptr<object>& socket_ptr)
 	{
 		BOOST_AUTO(raw_socket_ptr, boost::dynamic_pointer_cast<Socket>(socket_ptr));
@@ -88,8 +168,8 @@ public:
 
 	///////////////////////////////////////////////////
 	//msg sending interface
-	TCP_BROADCAST_MSG(broadcast_msg, send_msg)
-	TCP_BROADCAST_MSG(broadcast_native_msg, send_native_msg)
+	TCP_PARALLEL_BROADCAST_MSG(broadcast_msg, send_msg)
+	TCP_PARALLEL_BROADCAST_MSG(broadcast_native_msg, send_native_msg)
 	//guarantee send msg successfully even if can_overflow equal to false
 	//success at here just means putting the msg into tcp::socket_base's send buffer
 	TCP_BROADCAST_MSG(safe_broadcast_msg, safe_send_msg)
@@ -97,6 +177,9 @@ public:
 	//send message with sync mode
 	TCP_BROADCAST_MSG(sync_broadcast_msg, sync_send_msg)
 	TCP_BROADCAST_MSG(sync_broadcast_native_msg, sync_send_native_msg)
+	//pack only once, then share the packed message among all sockets (only for reference counted in_msg_type, see TCP_SHARED_BROADCAST_MSG)
+	TCP_SHARED_BROADCAST_MSG(shared_broadcast_msg, false)
+	TCP_SHARED_BROADCAST_MSG(shared_broadcast_native_msg, true)
 	//msg sending interface
 	///////////////////////////////////////////////////
 
@@ -111,24 +194,41 @@ public:
 protected:
 	virtual bool init()
 	{
-		boost::system::error_code ec;
-		if (!acceptor.is_open()) {acceptor.open(server_addr.protocol(), ec); assert(!ec);} //user maybe has opened this acceptor (to set options for example)
+		for (size_t i = 0; i < ST_ASIO_ACCEPTOR_NUM; ++i)
+		{
+			boost::asio::ip::tcp::acceptor& acceptor_ = get_acceptor(i);
+			boost::system::error_code ec;
+			if (!acceptor_.is_open()) {acceptor_.open(server_addr.protocol(), ec); assert(!ec);} //user maybe has opened this acceptor (to set options for example)
 #ifndef ST_ASIO_NOT_REUSE_ADDRESS
-		acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), ec); assert(!ec);
+			acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), ec); assert(!ec);
 #endif
-		acceptor.bind(server_addr, ec); assert(!ec);
-		if (ec) {get_service_pump().stop(); unified_out::error_out("bind failed."); return false;}
+#if ST_ASIO_ACCEPTOR_NUM > 1
+			acceptor_.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true), ec); assert(!ec);
+#endif
+			acceptor_.bind(server_addr, ec); assert(!ec);
+			if (ec) {get_service_pump().stop(); unified_out::error_out("bind failed."); return false;}
 #if BOOST_ASIO_VERSION >= 101100
-		acceptor.listen(boost::asio::ip::tcp::acceptor::max_listen_connections, ec); assert(!ec);
+			acceptor_.listen(boost::asio::ip::tcp::acceptor::max_listen_connections, ec); assert(!ec);
 #else
-		acceptor.listen(boost::asio::ip::tcp::acceptor::max_connections, ec); assert(!ec);
+			acceptor_.listen(boost::asio::ip::tcp::acceptor::max_connections, ec); assert(!ec);
+#endif
+			if (ec) {get_service_pump().stop(); unified_out::error_out("listen failed."); return false;}
+#if ST_ASIO_ACCEPT_BATCH > 0
+			acceptor_.non_blocking(true, ec); assert(!ec); //for batch accepting
 #endif
-		if (ec) {get_service_pump().stop(); unified_out::error_out("listen failed."); return false;}
+			accept_infos[i].concurrency.store(ST_ASIO_ASYNC_ACCEPT_NUM, boost::memory_order_relaxed);
+		}
 
 		ST_THIS start();
 
+		//with more than one acceptor, start accepting in the acceptor's io_context, so sockets will be placed in it, see assign_io_context
 		for (int i = 0; i < ST_ASIO_ASYNC_ACCEPT_NUM; ++i)
-			start_next_accept();
+			for (size_t j = 0; j < ST_ASIO_ACCEPTOR_NUM; ++j)
+#if ST_ASIO_ACCEPTOR_NUM > 1 && ST_ASIO_IO_CONTEXT_POOL > 0 && BOOST_ASIO_VERSION >= 101100
+				boost::asio::post(acceptor_io_context(j), boost::bind((void (server_base::*)(size_t)) &server_base::start_next_accept, this, j));
+#else
+				start_next_accept(j);
+#endif
 
 		return true;
 	}
@@ -137,7 +237,7 @@ protected:
 
 	//if you want to ignore this error and continue to accept new connections immediately, return true in this virtual function;
 	//if you want to ignore this error and continue to accept new connections after a specific delay, start a timer immediately and return false (don't call stop_listen()),
-	// when the timer ends up, call start_next_accept() in the callback function.
+	// when the timer ends up, call start_next_accept(index) in the callback function.
 	//otherwise, don't rewrite this virtual function or call server_base::on_accept_error() directly after your code.
 	virtual bool on_accept_error(const boost::system::error_code& ec, typename Pool::object_ctype& socket_ptr)
 	{
@@ -150,10 +250,17 @@ protected:
 		return false;
 	}
 
-	virtual void start_next_accept()
+	//for the first acceptor
+	virtual void start_next_accept() {do_start_next_accept(0);}
+	//for all acceptors, all (re-)arming goes through here, the first acceptor is still routed to start_next_accept() for compatibility
+	virtual void start_next_accept(size_t index) {0 == index ? start_next_accept() : do_start_next_accept(index);}
+	void do_start_next_accept(size_t index)
 	{
 		typename Pool::object_type socket_ptr = ST_THIS create_object(boost::ref(*this));
-		acceptor.async_accept(socket_ptr->lowest_layer(), boost::bind(&server_base::accept_handler, this, boost::asio::placeholders::error, socket_ptr));
+		acceptor_info& info = accept_infos[index];
+		if (!info.take_reserved()) //not reserved by accept_handler
+			info.pending_num.fetch_add(1, boost::memory_order_relaxed);
+		get_acceptor(index).async_accept(socket_ptr->lowest_layer(), boost::bind(&server_base::accept_handler, this, boost::asio::placeholders::error, socket_ptr, index));
 	}
 
 protected:
@@ -170,22 +277,143 @@ protected:
 		return false;
 	}
 
-	void accept_handler(const boost::system::error_code& ec, typename Pool::object_ctype& socket_ptr)
+	void accept_handler(const boost::system::error_code& ec, typename Pool::object_ctype& socket_ptr, size_t index)
 	{
+		acceptor_info& info = accept_infos[index];
+		size_t pending_num = info.pending_num.fetch_sub(1, boost::memory_order_relaxed) - 1;
 		if (!ec)
 		{
-			if (on_accept(socket_ptr) && add_socket(socket_ptr))
-				socket_ptr->start();
+			handle_accepted_socket(socket_ptr, index);
 
-			start_next_accept();
+			//all async_accept have been consumed or the backlog still has connections means we're busy
+			bool busy = 0 == pending_num;
+#if ST_ASIO_ACCEPT_BATCH > 0
+			busy = batch_accept(index) > 0 || busy;
+#endif
+			adjust_accept_concurrency(info, busy);
+
+			for (size_t num = info.reserve(info.concurrency.load(boost::memory_order_relaxed)); num > 0; --num)
+				start_next_accept(index);
 		}
 		else if (on_accept_error(ec, socket_ptr))
-			start_next_accept();
+			start_next_accept(index);
+	}
+
+private:
+	struct acceptor_info
+	{
+		acceptor_info() : accept_num(0), batch_accept_num(0), pending_num(0), reserved_num(0), concurrency(ST_ASIO_ASYNC_ACCEPT_NUM),
+			last_accept_time(0), batching(0), rate_second(0), rate_num(0), last_rate_num(0) {}
+
+		//reserve async_accept slots (pending_num) up to concurrency in one atomic step, so concurrent accept handlers never deliver more
+		//async_accept than wanted, return how many slots been reserved, they will be taken by do_start_next_accept.
+		size_t reserve(size_t concurrency)
+		{
+			size_t pending = pending_num.load(boost::memory_order_relaxed), num;
+			do
+				num = pending < concurrency ? concurrency - pending : 0;
+			while (num > 0 && !pending_num.compare_exchange_weak(pending, concurrency, boost::memory_order_relaxed, boost::memory_order_relaxed));
+
+			reserved_num.fetch_add(num, boost::memory_order_relaxed);
+			return num;
+		}
+		bool take_reserved()
+		{
+			size_t reserved = reserved_num.load(boost::memory_order_relaxed);
+			while (reserved > 0 && !reserved_num.compare_exchange_weak(reserved, reserved - 1, boost::memory_order_relaxed, boost::memory_order_relaxed));
+			return reserved > 0;
+		}
+
+		//count accepted connections in seconds, see accept_rate
+		void count_rate()
+		{
+			boost::uint_fast64_t now = time(NULL), second = rate_second.load(boost::memory_order_relaxed);
+			if (now != second && rate_second.compare_exchange_strong(second, now, boost::memory_order_relaxed, boost::memory_order_relaxed))
+			{
+				size_t num = rate_num.exchange(0, boost::memory_order_relaxed);
+				last_rate_num.store(now == second + 1 ? num : 0, boost::memory_order_relaxed);
+			}
+			rate_num.fetch_add(1, boost::memory_order_relaxed);
+		}
+
+		atomic_size_t accept_num, batch_accept_num, pending_num, reserved_num, concurrency;
+		atomic_uint_fast64 last_accept_time; //seconds
+		atomic_size_t batching; //only one thread can do batch accepting at the same time on the same acceptor
+		typename Pool::object_type spare_socket; //for batch accepting, it's needed to try to accept a connection, keep it if failed
+		atomic_uint_fast64 rate_second; //the second which rate_num belongs to
+		atomic_size_t rate_num, last_rate_num; //accepted connections in rate_second and the second before it
+	};
+
+	void handle_accepted_socket(typename Pool::object_ctype& socket_ptr, size_t index)
+	{
+		accept_infos[index].accept_num.fetch_add(1, boost::memory_order_relaxed);
+		accept_infos[index].count_rate();
+		if (on_accept(socket_ptr) && add_socket(socket_ptr))
+			socket_ptr->start();
 	}
 
+	//double the concurrency if busy, or decrease it by one if no connections arrived in the last second.
+	void adjust_accept_concurrency(acceptor_info& info, bool busy)
+	{
+#if ST_ASIO_MAX_ASYNC_ACCEPT_NUM > ST_ASIO_ASYNC_ACCEPT_NUM
+		boost::uint_fast64_t now = time(NULL);
+		size_t concurrency = info.concurrency.load(boost::memory_order_relaxed);
+		if (busy)
+			info.concurrency.store(std::min((size_t) ST_ASIO_MAX_ASYNC_ACCEPT_NUM, 2 * concurrency), boost::memory_order_relaxed);
+		else if (concurrency > ST_ASIO_ASYNC_ACCEPT_NUM && info.last_accept_time.load(boost::memory_order_relaxed) < now)
+			info.concurrency.store(concurrency - 1, boost::memory_order_relaxed);
+		info.last_accept_time.store(now, boost::memory_order_relaxed);
+#endif
+	}
+
+#if ST_ASIO_ACCEPT_BATCH > 0
+	//after an async_accept succeeded, accept connections remaining in the backlog synchronously (the acceptor is in non-blocking mode),
+	//this saves a round trip through the reactor per connection, return how many connections been accepted.
+	size_t batch_accept(size_t index)
+	{
+		acceptor_info& info = accept_infos[index];
+		scope_atomic_lock<> lock(info.batching);
+		if (!lock.locked()) //another thread is draining the backlog
+			return 0;
+
+		size_t num = 0;
+		for (boost::system::error_code ec; num < ST_ASIO_ACCEPT_BATCH; ++num)
+		{
+			if (!info.spare_socket)
+				info.spare_socket = ST_THIS create_object(boost::ref(*this));
+
+			get_acceptor(index).accept(info.spare_socket->lowest_layer(), ec);
+			if (ec) //would_block means the backlog is empty, other errors will be reported by async_accept
+				break;
+
+			typename Pool::object_type socket_ptr;
+			socket_ptr.swap(info.spare_socket);
+			handle_accepted_socket(socket_ptr, index);
+		}
+
+		info.batch_accept_num.fetch_add(num, boost::memory_order_relaxed);
+		if (!get_acceptor(index).is_open()) //stop_listen() failed to release the spare socket because we were batch accepting
+			info.spare_socket.reset();
+
+		return num;
+	}
+
+	void release_spare_socket(size_t index)
+	{
+		acceptor_info& info = accept_infos[index];
+		scope_atomic_lock<> lock(info.batching);
+		if (lock.locked()) //otherwise, batch_accept will release it, stop_listen() may be called in on_accept (within batch_accept)
+			info.spare_socket.reset();
+	}
+#endif
+
 protected:
 	boost::asio::ip::tcp::endpoint server_addr;
-	boost::asio::ip::tcp::acceptor acceptor;
+	boost::asio::ip::tcp::acceptor acceptor; //the first acceptor
+#if ST_ASIO_ACCEPTOR_NUM > 1
+	std::vector<boost::shared_ptr<boost::asio::ip::tcp::acceptor> > acceptors; //other acceptors
+#endif
+	acceptor_info accept_infos[ST_ASIO_ACCEPTOR_NUM];
 };
 
 }} //namespace
@@ -28,9 +28,9 @@ private:
 	typedef socket_base<Socket, Packer, Unpacker, InQueue, InContainer, OutQueue, OutContainer> super;
 
 public:
-	server_socket_base(Server& server_) : super(server_.get_service_pump()), server(server_) {}
+	server_socket_base(Server& server_) : super(server_.assign_io_context()), server(server_) {}
 	template<typename Arg>
-	server_socket_base(Server& server_, Arg& arg) : super(server_.get_service_pump(), arg), server(server_) {}
+	server_socket_base(Server& server_, Arg& arg) : super(server_.assign_io_context(), arg), server(server_) {}
 
 	//reset all, be ensure that there's no any operations performed on this socket when invoke it
 	//subclass must re-write this function to initialize itself, and then do not forget to invoke superclass' reset function too
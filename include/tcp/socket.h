@@ -14,6 +14,19 @@
 #define ST_ASIO_TCP_SOCKET_H_
 
 #include "../socket.h"
+#include "../container.h"
+
+#ifdef ST_ASIO_ZERO_COPY_SEND
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+
+#if defined(IOV_MAX) && ST_ASIO_MAX_SEND_BUF_NUM > IOV_MAX
+	#error max send buffer number must be less than or equal to IOV_MAX.
+#endif
 
 namespace st_asio_wrapper { namespace tcp {
 
@@ -34,11 +47,29 @@ private:
 protected:
 	enum link_status {CONNECTED, FORCE_SHUTTING_DOWN, GRACEFUL_SHUTTING_DOWN, BROKEN};
 
+#if ST_ASIO_SEND_LINGER > 0
+	socket_base(boost::asio::io_context& io_context_) : super(io_context_), linger_timer(io_context_) {first_init();}
+	template<typename Arg> socket_base(boost::asio::io_context& io_context_, Arg& arg) : super(io_context_, arg), linger_timer(io_context_) {first_init();}
+#else
 	socket_base(boost::asio::io_context& io_context_) : super(io_context_) {first_init();}
 	template<typename Arg> socket_base(boost::asio::io_context& io_context_, Arg& arg) : super(io_context_, arg) {first_init();}
+#endif
 
 	//helper function, just call it in constructor
-	void first_init() {status = BROKEN; unpacker_ = boost::make_shared<Unpacker>();}
+	void first_init()
+	{
+		status = BROKEN; unpacker_ = boost::make_shared<Unpacker>();
+#if ST_ASIO_SEND_LINGER > 0
+		lingering = false;
+#endif
+#ifdef ST_ASIO_LOCAL_UNPACKER
+		relocate_unpacker = true;
+#endif
+#ifdef ST_ASIO_ZERO_COPY_SEND
+		file_sent_size = 0;
+		use_pread = false;
+#endif
+	}
 
 public:
 	static const timer::tid TIMER_BEGIN = super::TIMER_END;
@@ -57,7 +88,16 @@ public:
 	}
 
 	//reset all, be ensure that there's no any operations performed on this tcp::socket_base when invoke it
-	void reset() {status = BROKEN; last_send_msg.clear(); unpacker_->reset(); super::reset();}
+	void reset()
+	{
+		status = BROKEN; last_send_msg.clear(); unpacker_->reset(); super::reset();
+#ifdef ST_ASIO_ZERO_COPY_SEND
+		file_msg.clear();
+#endif
+#if ST_ASIO_SEND_LINGER > 0
+		lingering = false;
+#endif
+	}
 
 	//SOCKET status
 	bool is_broken() const {return BROKEN == status;}
@@ -69,7 +109,11 @@ public:
 	//we can resolve this defect via mutex, but i think it's not worth, because this feature is not frequently used
 	boost::shared_ptr<i_unpacker<out_msg_type> > unpacker() {return unpacker_;}
 	boost::shared_ptr<const i_unpacker<out_msg_type> > unpacker() const {return unpacker_;}
+#ifdef ST_ASIO_LOCAL_UNPACKER
+	void unpacker(const boost::shared_ptr<i_unpacker<out_msg_type> >& _unpacker_) {unpacker_ = _unpacker_; relocate_unpacker = false;}
+#else
 	void unpacker(const boost::shared_ptr<i_unpacker<out_msg_type> >& _unpacker_) {unpacker_ = _unpacker_;}
+#endif
 
 	using super::send_msg;
 	///////////////////////////////////////////////////
@@ -132,9 +176,13 @@ protected:
 	//return -1 means error occurred, otherwise the number of bytes been sent
 	size_t do_sync_send_msg(in_msg_ctype& msg)
 	{
+#ifdef ST_ASIO_ZERO_COPY_SEND
+		assert(NULL == msg_file_traits<in_msg_type>::file_source(msg)); //file ranges can only be sent asynchronously
+#endif
 		boost::system::error_code ec;
 		auto_duration dur(ST_THIS stat.send_time_sum);
-		size_t send_size = boost::asio::write(ST_THIS next_layer(), ST_ASIO_SEND_BUFFER_TYPE(msg.data(), msg.size()), ec);
+		size_t buf_num = fill_send_bufs(msg, 0); //we're holding the sending flag, so send_bufs is available
+		size_t send_size = boost::asio::write(ST_THIS next_layer(), buffer_range<boost::asio::const_buffer>(send_bufs.data(), send_bufs.data() + buf_num), ec);
 		dur.end();
 
 		send_handler(ec, send_size);
@@ -153,36 +201,105 @@ protected:
 	//return false if send buffer is empty
 	virtual bool do_send_msg()
 	{
-		boost::container::list<boost::asio::const_buffer> bufs;
+#ifdef ST_ASIO_ZERO_COPY_SEND
+		if (!file_msg.empty()) //gather buffers before the file range have been sent
+		{
+			last_send_msg.emplace_back();
+			last_send_msg.back().swap(file_msg);
+			last_send_msg.front().restart();
+			begin_send_file();
+			return true;
+		}
+#endif
+#if ST_ASIO_SEND_LINGER > 0
+		//neither enough msgs to fill the gather buffers nor enough bytes to reach ST_ASIO_MAX_SEND_SIZE, wait a moment for more msgs (only once)
+		if (!lingering && !ST_THIS send_msg_buffer.empty() && ST_THIS send_msg_buffer.size() < send_bufs.size() &&
+			ST_THIS send_byte_num.load(boost::memory_order_relaxed) < ST_ASIO_MAX_SEND_SIZE)
+		{
+			lingering = true;
+#if BOOST_ASIO_VERSION >= 101100
+			linger_timer.expires_after(timer::microseconds(ST_ASIO_SEND_LINGER));
+#else
+			linger_timer.expires_from_now(timer::microseconds(ST_ASIO_SEND_LINGER));
+#endif
+			linger_timer.async_wait(ST_THIS make_handler_error(boost::bind(&socket_base::linger_handler, this, boost::asio::placeholders::error)));
+			return true;
+		}
+		lingering = false;
+#endif
+
+		size_t buf_num = 0;
 		{
 #ifdef ST_ASIO_WANT_MSG_SEND_NOTIFY
 			const size_t max_send_size = 1;
 #else
-			const size_t max_send_size = boost::asio::detail::default_max_transfer_size;
+			const size_t max_send_size = ST_ASIO_MAX_SEND_SIZE;
 #endif
 			size_t size = 0;
+#if ST_ASIO_MERGE_MSG_SIZE > 0
+			size_t merged_size = 0, merge_begin = 0;
+			bool merging = false; //the last gather buffer refers to merge_buff
+#endif
 			typename super::in_msg msg;
 			BOOST_AUTO(end_time, statistic::local_time());
 
 			typename super::in_container_type::lock_guard lock(ST_THIS send_msg_buffer);
-			while (ST_THIS send_msg_buffer.try_dequeue_(msg))
+			while (buf_num + msg_buffer_traits<in_msg_type>::MAX_BUFFER_NUM <= send_bufs.size() && ST_THIS send_msg_buffer.try_dequeue_(msg))
 			{
 				ST_THIS stat.send_delay_sum += end_time - msg.begin_time;
+#if ST_ASIO_SEND_LINGER > 0
+				ST_THIS send_byte_num.fetch_sub(msg.size(), boost::memory_order_relaxed);
+#endif
+#ifdef ST_ASIO_ZERO_COPY_SEND
+				if (NULL != msg_file_traits<in_msg_type>::file_source(msg))
+				{
+					file_msg.swap(msg); //will be sent after gather buffers (if any) which come before it
+					break;
+				}
+#endif
 				size += msg.size();
 				last_send_msg.emplace_back();
 				last_send_msg.back().swap(msg);
-				bufs.emplace_back(last_send_msg.back().data(), last_send_msg.back().size());
+
+				typename super::in_msg& cur_msg = last_send_msg.back();
+#if ST_ASIO_MERGE_MSG_SIZE > 0
+				if (cur_msg.size() <= ST_ASIO_MERGE_MSG_SIZE && merged_size + cur_msg.size() <= merge_buff.size())
+				{
+					if (!merging)
+					{
+						merging = true;
+						merge_begin = merged_size;
+						++buf_num;
+					}
+
+					for (size_t i = 0; i < msg_buffer_traits<in_msg_type>::buffer_num(cur_msg); ++i)
+						merged_size += boost::asio::buffer_copy(boost::asio::buffer(merge_buff.data() + merged_size, merge_buff.size() - merged_size),
+							msg_buffer_traits<in_msg_type>::buffer(cur_msg, i));
+					send_bufs[buf_num - 1] = boost::asio::const_buffer(merge_buff.data() + merge_begin, merged_size - merge_begin);
+				}
+				else
+				{
+					merging = false;
+					buf_num = fill_send_bufs(cur_msg, buf_num);
+				}
+#else
+				buf_num = fill_send_bufs(cur_msg, buf_num);
+#endif
 				if (size >= max_send_size)
 					break;
 			}
 		}
 
-		if (bufs.empty())
+		if (0 == buf_num)
+#ifdef ST_ASIO_ZERO_COPY_SEND
+			return !file_msg.empty() && do_send_msg(); //the file range is the first message
+#else
 			return false;
+#endif
 
 		last_send_msg.front().restart();
-		boost::asio::async_write(ST_THIS next_layer(), bufs,
-			ST_THIS make_handler_error_size(boost::bind(&socket_base::send_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+		boost::asio::async_write(ST_THIS next_layer(), buffer_range<boost::asio::const_buffer>(send_bufs.data(), send_bufs.data() + buf_num),
+			ST_THIS make_handler_error_size(ST_THIS send_mem, boost::bind(&socket_base::send_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
 		return true;
 	}
 
@@ -190,19 +307,39 @@ protected:
 	{
 		last_send_msg.emplace_back();
 		last_send_msg.back().swap(msg);
-		boost::asio::async_write(ST_THIS next_layer(), ST_ASIO_SEND_BUFFER_TYPE(last_send_msg.back().data(), last_send_msg.back().size()),
-			ST_THIS make_handler_error_size(boost::bind(&socket_base::send_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+#ifdef ST_ASIO_ZERO_COPY_SEND
+		if (NULL != msg_file_traits<in_msg_type>::file_source(last_send_msg.back()))
+			begin_send_file();
+		else
+#endif
+		if (msg_buffer_traits<in_msg_type>::MAX_BUFFER_NUM > 1)
+		{
+			size_t buf_num = fill_send_bufs(last_send_msg.back(), 0);
+			boost::asio::async_write(ST_THIS next_layer(), buffer_range<boost::asio::const_buffer>(send_bufs.data(), send_bufs.data() + buf_num),
+				ST_THIS make_handler_error_size(ST_THIS send_mem, boost::bind(&socket_base::send_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+		}
+		else
+			boost::asio::async_write(ST_THIS next_layer(), ST_ASIO_SEND_BUFFER_TYPE(last_send_msg.back().data(), last_send_msg.back().size()),
+				ST_THIS make_handler_error_size(ST_THIS send_mem, boost::bind(&socket_base::send_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
 		return true;
 	}
 
 	virtual void do_recv_msg()
 	{
+#ifdef ST_ASIO_LOCAL_UNPACKER
+		if (relocate_unpacker)
+		{
+			relocate_unpacker = false;
+			ST_THIS post(boost::bind(&socket_base::relocate_and_recv, this));
+			return;
+		}
+#endif
 		BOOST_AUTO(recv_buff, unpacker_->prepare_next_recv());
 		assert(boost::asio::buffer_size(recv_buff) > 0);
 
 		boost::asio::async_read(ST_THIS next_layer(), recv_buff,
 			boost::bind(&socket_base::completion_checker, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred),
-			ST_THIS make_handler_error_size(boost::bind(&socket_base::recv_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+			ST_THIS make_handler_error_size(ST_THIS recv_mem, boost::bind(&socket_base::recv_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
 	}
 
 	virtual void on_connect() {}
@@ -218,13 +355,147 @@ protected:
 	virtual bool on_msg_handle(out_msg_type& msg) {unified_out::debug_out("recv(" ST_ASIO_SF "): %s", msg.size(), msg.data()); return true;}
 
 private:
+	BOOST_STATIC_ASSERT(ST_ASIO_MAX_SEND_BUF_NUM >= msg_buffer_traits<in_msg_type>::MAX_BUFFER_NUM);
+
+	//append msg's gather buffers to send_bufs from index buf_num, return the new buf_num.
+	size_t fill_send_bufs(in_msg_ctype& msg, size_t buf_num)
+	{
+		for (size_t i = 0; i < msg_buffer_traits<in_msg_type>::buffer_num(msg); ++i)
+			send_bufs[buf_num++] = msg_buffer_traits<in_msg_type>::buffer(msg, i);
+
+		return buf_num;
+	}
+
+#ifdef ST_ASIO_ZERO_COPY_SEND
+	//last_send_msg.front() is a file range (and the only message in last_send_msg).
+	void begin_send_file()
+	{
+		file_sent_size = 0;
+		use_pread = false;
+
+		boost::system::error_code ec;
+		ST_THIS next_layer().native_non_blocking(true, ec);
+		if (ec)
+			send_handler(ec, 0);
+		else
+			send_file();
+	}
+
+	//send until the file range been sent out, or the socket's sending buffer is full, or ST_ASIO_MAX_SEND_FILE_SIZE bytes been sent
+	//in this round, in the last two cases, wait for the socket to be writable (this also gives other handlers a chance to run).
+	void send_file()
+	{
+		BOOST_AUTO(source, msg_file_traits<in_msg_type>::file_source(last_send_msg.front()));
+		assert(NULL != source);
+#ifdef __linux__
+		if (!use_pread)
+		{
+			boost::system::error_code ec;
+			size_t round_size = 0;
+			while (source->left() > 0)
+			{
+				if (round_size >= ST_ASIO_MAX_SEND_FILE_SIZE)
+					return wait_writable();
+
+				off_t offset = (off_t) source->offset();
+				size_t len = (size_t) std::min(source->left(), (boost::int64_t) (ST_ASIO_MAX_SEND_FILE_SIZE - round_size));
+				ssize_t send_size = ::sendfile(ST_THIS next_layer().native_handle(), source->fd(), &offset, len);
+				if (send_size > 0)
+				{
+					source->consume((size_t) send_size);
+					round_size += (size_t) send_size;
+					file_sent_size += (size_t) send_size;
+				}
+				else if (0 == send_size) //the file has been truncated
+				{
+					ec = boost::asio::error::eof;
+					break;
+				}
+				else if (EAGAIN == errno || EWOULDBLOCK == errno)
+					return wait_writable();
+				else if (0 == file_sent_size && (EINVAL == errno || ENOSYS == errno)) //sendfile is not supported by this file
+				{
+					use_pread = true;
+					return send_file();
+				}
+				else if (EINTR != errno)
+				{
+					ec = boost::system::error_code(errno, boost::system::system_category());
+					break;
+				}
+			}
+
+			//post rather than call send_handler directly, otherwise the next range will be begun inline, then successive ranges
+			//recurse without bound and never yield (ST_ASIO_MAX_SEND_FILE_SIZE only limits one range).
+			ST_THIS post(ST_THIS send_mem, boost::bind(&socket_base::send_handler, this, ec, file_sent_size));
+			return;
+		}
+#endif
+		//fall back to pread and async_write
+		if (0 == source->left())
+			return send_handler(boost::system::error_code(), file_sent_size);
+
+		if (file_buff.empty())
+			file_buff.resize(boost::asio::detail::default_max_transfer_size);
+		size_t len = (size_t) std::min(source->left(), (boost::int64_t) file_buff.size());
+		ssize_t read_size = pread(source->fd(), &file_buff.front(), len, (off_t) source->offset());
+		if (read_size <= 0)
+			send_handler(read_size < 0 ? boost::system::error_code(errno, boost::system::system_category()) : boost::asio::error::eof, file_sent_size);
+		else
+			boost::asio::async_write(ST_THIS next_layer(), boost::asio::buffer(&file_buff.front(), (size_t) read_size),
+				ST_THIS make_handler_error_size(ST_THIS send_mem, boost::bind(&socket_base::send_file_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+	}
+
+	void wait_writable()
+	{
+#if BOOST_ASIO_VERSION >= 101100
+		ST_THIS next_layer().async_wait(boost::asio::socket_base::wait_write,
+			ST_THIS make_handler_error(ST_THIS send_mem, boost::bind(&socket_base::send_file_handler, this, boost::asio::placeholders::error, 0)));
+#else
+		ST_THIS next_layer().async_write_some(boost::asio::null_buffers(),
+			ST_THIS make_handler_error_size(ST_THIS send_mem, boost::bind(&socket_base::send_file_handler, this, boost::asio::placeholders::error, 0)));
+#endif
+	}
+
+	void send_file_handler(const boost::system::error_code& ec, size_t bytes_transferred)
+	{
+		if (ec)
+			send_handler(ec, file_sent_size);
+		else
+		{
+			if (bytes_transferred > 0) //pread and async_write
+			{
+				msg_file_traits<in_msg_type>::file_source(last_send_msg.front())->consume(bytes_transferred);
+				file_sent_size += bytes_transferred;
+			}
+			send_file();
+		}
+	}
+#endif
+
 	void shutdown()
 	{
 		if (!is_broken())
 			status = FORCE_SHUTTING_DOWN; //not thread safe because of this assignment
+#if ST_ASIO_SEND_LINGER > 0
+		boost::system::error_code ec;
+		linger_timer.cancel(ec);
+#endif
 		ST_THIS close();
 	}
 
+#ifdef ST_ASIO_LOCAL_UNPACKER
+	//re-create the default unpacker in the service thread which serves this socket, then its buffer will be allocated on the right NUMA node.
+	void relocate_and_recv()
+	{
+		if (is_connected() || GRACEFUL_SHUTTING_DOWN == status)
+		{
+			unpacker_ = boost::make_shared<Unpacker>();
+			do_recv_msg();
+		}
+	}
+#endif
+
 	size_t completion_checker(const boost::system::error_code& ec, size_t bytes_transferred)
 	{
 		auto_duration dur(ST_THIS stat.unpack_time_sum);
@@ -302,6 +573,18 @@ private:
 		}
 	}
 
+#if ST_ASIO_SEND_LINGER > 0
+	void linger_handler(const boost::system::error_code& ec)
+	{
+		if (ec || !do_send_msg())
+		{
+			ST_THIS sending = false;
+			if (!ec && !ST_THIS send_msg_buffer.empty())
+				ST_THIS send_msg(); //just make sure no pending msgs
+		}
+	}
+#endif
+
 	bool async_shutdown_handler(size_t loop_num)
 	{
 		if (GRACEFUL_SHUTTING_DOWN == status)
@@ -324,8 +607,25 @@ private:
 	}
 
 protected:
-	boost::container::list<typename super::in_msg> last_send_msg;
+	chunk_list<typename super::in_msg> last_send_msg; //reuses its chunks, so no memory allocation after warming up
+	boost::array<boost::asio::const_buffer, ST_ASIO_MAX_SEND_BUF_NUM> send_bufs; //reused by every async_write
+#if ST_ASIO_MERGE_MSG_SIZE > 0
+	boost::array<char, ST_ASIO_MERGE_BUFFER_SIZE> merge_buff; //small msgs will be copied into it, and be sent as one gather buffer
+#endif
+#if ST_ASIO_SEND_LINGER > 0
+	timer::timer_type linger_timer;
+	bool lingering;
+#endif
+#ifdef ST_ASIO_ZERO_COPY_SEND
+	typename super::in_msg file_msg; //a file range which is waiting for the gather buffers before it to be sent
+	std::vector<char> file_buff; //only used when sendfile is not available
+	size_t file_sent_size;
+	bool use_pread;
+#endif
 	boost::shared_ptr<i_unpacker<out_msg_type> > unpacker_;
+#ifdef ST_ASIO_LOCAL_UNPACKER
+	bool relocate_unpacker; //still using the default unpacker which was created by the constructor
+#endif
 
 	volatile link_status status;
 };
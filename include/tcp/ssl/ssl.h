@@ -29,6 +29,9 @@ class socket : public Socket
 #if defined(ST_ASIO_REUSE_OBJECT) && !defined(ST_ASIO_REUSE_SSL_STREAM)
 	#error please define ST_ASIO_REUSE_SSL_STREAM macro explicitly if you need boost::asio::ssl::stream to be reusable!
 #endif
+#ifdef ST_ASIO_ZERO_COPY_SEND
+	#error ssl sockets can not send file ranges via sendfile, please undefine ST_ASIO_ZERO_COPY_SEND macro!
+#endif
 
 public:
 	template<typename Arg>
@@ -157,7 +160,7 @@ public:
 	object_pool(service_pump& service_pump_, boost::asio::ssl::context::method m) : super(service_pump_), ctx(m) {}
 	boost::asio::ssl::context& context() {return ctx;}
 
-	typename object_pool::object_type create_object() {return create_object(boost::ref(ST_THIS sp));}
+	typename object_pool::object_type create_object() {return create_object(boost::ref(ST_THIS sp.assign_io_context()));}
 	template<typename Arg>
 	typename object_pool::object_type create_object(Arg& arg) {return super::create_object(arg, boost::ref(ctx));}
 
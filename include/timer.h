@@ -25,6 +25,245 @@
 namespace st_asio_wrapper
 {
 
+#if ST_ASIO_TIMER_WHEEL_TICK > 0
+//a hierarchical timing wheel (like the one in linux kernel before 4.8), it's an io_context service, so all timers in the same io_context share it.
+//to reduce lock contention, it's divided into shards (as many as CPU cores), every shard is driven by one asio timer which ticks every
+//ST_ASIO_TIMER_WHEEL_TICK milliseconds (only when it has timers), so only a few kernel-backed timers are needed no matter how many timers we have.
+class timer_wheel : public boost::asio::detail::service_base<timer_wheel>
+{
+public:
+	typedef boost::function<void(const boost::system::error_code&)> handler_type;
+
+	struct entry
+	{
+		entry* next;
+		entry** pprev;
+		boost::uint64_t expiry; //in ticks
+		entry** owner; //where the owner keeps this entry, will be set to NULL after this entry fired or been canceled
+		handler_type handler;
+	};
+
+private:
+	enum {ROOT_BITS = 8, LEVEL_BITS = 6, LEVEL_NUM = 3, ROOT_SIZE = 1 << ROOT_BITS, LEVEL_SIZE = 1 << LEVEL_BITS};
+	static const boost::uint64_t MAX_DELTA = (boost::uint64_t) 1 << (ROOT_BITS + LEVEL_NUM * LEVEL_BITS);
+
+	struct shard : public boost::noncopyable
+	{
+		shard(boost::asio::io_context& io_context_) : cur_tick(0), num(0), armed(false), timer(io_context_)
+			{memset(root, 0, sizeof(root)); memset(levels, 0, sizeof(levels));}
+
+		boost::mutex mutex;
+		entry* root[ROOT_SIZE];
+		entry* levels[LEVEL_NUM][LEVEL_SIZE];
+		boost::uint64_t cur_tick; //the next tick to be processed
+		size_t num;
+		bool armed;
+		boost::asio::deadline_timer timer;
+	};
+
+public:
+	timer_wheel(boost::asio::io_context& io_context_) : boost::asio::detail::service_base<timer_wheel>(io_context_),
+		io_context(io_context_), begin_time(boost::posix_time::microsec_clock::universal_time())
+	{
+		size_t shard_num = std::max(boost::thread::hardware_concurrency(), 1u);
+		for (size_t i = 0; i < shard_num; ++i)
+			shards.push_back(new shard(io_context_));
+	}
+	~timer_wheel() {do_shutdown(); for (BOOST_AUTO(iter, shards.begin()); iter != shards.end(); ++iter) delete *iter;}
+
+	//slot must be NULL (no pending entry), it will hold the new entry until it fired or been canceled.
+	void add(entry*& slot, size_t interval, const handler_type& handler)
+	{
+		BOOST_AUTO(e, new entry());
+		e->handler = handler;
+		e->owner = &slot;
+
+		shard& s = get_shard(slot);
+		boost::lock_guard<boost::mutex> lock(s.mutex);
+		assert(NULL == slot);
+
+		BOOST_AUTO(now, now_ms());
+		if (0 == s.num && s.cur_tick < now / ST_ASIO_TIMER_WHEEL_TICK) //idle, no need to walk through all the past ticks
+			s.cur_tick = now / ST_ASIO_TIMER_WHEEL_TICK;
+		e->expiry = std::max((now + interval + ST_ASIO_TIMER_WHEEL_TICK - 1) / ST_ASIO_TIMER_WHEEL_TICK, s.cur_tick); //never fire earlier
+		link(s, e);
+		slot = e;
+
+		++s.num;
+		if (!s.armed)
+			arm(s);
+	}
+
+	//the handler will be invoked asynchronously with boost::asio::error::operation_aborted
+	void cancel(entry*& slot)
+	{
+		handler_type handler;
+		if (!remove(slot, handler))
+			return;
+
+#if BOOST_ASIO_VERSION >= 101100
+		boost::asio::post(io_context, boost::bind(handler, boost::system::error_code(boost::asio::error::operation_aborted)));
+#else
+		io_context.post(boost::bind(handler, boost::system::error_code(boost::asio::error::operation_aborted)));
+#endif
+	}
+
+	//the handler will not be invoked
+	void remove(entry*& slot) {handler_type handler; remove(slot, handler);}
+
+private:
+	bool remove(entry*& slot, handler_type& handler)
+	{
+		shard& s = get_shard(slot);
+		boost::lock_guard<boost::mutex> lock(s.mutex);
+		if (NULL == slot)
+			return false;
+
+		unlink(slot);
+		--s.num;
+		handler.swap(slot->handler);
+		delete slot;
+		slot = NULL;
+
+		return true;
+	}
+
+#if BOOST_ASIO_VERSION >= 101100
+	virtual void shutdown() {do_shutdown();}
+#else
+	virtual void shutdown_service() {do_shutdown();}
+#endif
+
+	void do_shutdown()
+	{
+		for (BOOST_AUTO(iter, shards.begin()); iter != shards.end(); ++iter)
+		{
+			shard& s = **iter;
+			boost::lock_guard<boost::mutex> lock(s.mutex);
+			boost::system::error_code ec;
+			s.timer.cancel(ec);
+
+			for (size_t i = 0; i < ROOT_SIZE; ++i)
+				free_entries(s.root[i]);
+			for (size_t i = 0; i < LEVEL_NUM; ++i)
+				for (size_t j = 0; j < LEVEL_SIZE; ++j)
+					free_entries(s.levels[i][j]);
+			s.num = 0;
+		}
+	}
+
+	shard& get_shard(entry*& slot) {return *shards[(reinterpret_cast<size_t>(&slot) / sizeof(void*)) % shards.size()];}
+	boost::uint64_t now_ms() const {return (boost::uint64_t) (boost::posix_time::microsec_clock::universal_time() - begin_time).total_milliseconds();}
+
+	void arm(shard& s)
+	{
+		s.armed = true;
+		s.timer.expires_at(begin_time + boost::posix_time::milliseconds(s.cur_tick * ST_ASIO_TIMER_WHEEL_TICK));
+		s.timer.async_wait(boost::bind(&timer_wheel::tick_handler, this, boost::ref(s), boost::asio::placeholders::error));
+	}
+
+	void tick_handler(shard& s, const boost::system::error_code& ec)
+	{
+		if (ec)
+			return;
+
+		entry* expired = NULL;
+		{
+			boost::lock_guard<boost::mutex> lock(s.mutex);
+			for (BOOST_AUTO(tick, now_ms() / ST_ASIO_TIMER_WHEEL_TICK); s.cur_tick <= tick; ++s.cur_tick)
+			{
+				size_t index = (size_t) (s.cur_tick & (ROOT_SIZE - 1));
+				for (size_t level = 0; 0 == index && level < LEVEL_NUM; ++level) //cascade timers from higher levels
+					index = cascade(s, level, (size_t) ((s.cur_tick >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1)));
+
+				index = (size_t) (s.cur_tick & (ROOT_SIZE - 1));
+				while (NULL != s.root[index])
+				{
+					BOOST_AUTO(e, s.root[index]);
+					unlink(e);
+					*e->owner = NULL;
+					--s.num;
+
+					e->next = expired;
+					expired = e;
+				}
+			}
+
+			if (s.num > 0)
+				arm(s);
+			else
+				s.armed = false;
+		}
+
+		while (NULL != expired)
+		{
+			BOOST_AUTO(e, expired);
+			expired = e->next;
+			e->handler(ec);
+			delete e;
+		}
+	}
+
+	static void link(shard& s, entry* e)
+	{
+		entry** head;
+		BOOST_AUTO(expiry, std::max(e->expiry, s.cur_tick));
+		BOOST_AUTO(delta, expiry - s.cur_tick);
+		if (delta < ROOT_SIZE)
+			head = &s.root[expiry & (ROOT_SIZE - 1)];
+		else
+		{
+			if (delta >= MAX_DELTA) //too far, park it at the farthest slot, it will be re-linked when cascading
+				expiry = s.cur_tick + (delta = MAX_DELTA - 1);
+
+			size_t level = 0;
+			while (level < LEVEL_NUM - 1 && delta >= ((boost::uint64_t) 1 << (ROOT_BITS + (level + 1) * LEVEL_BITS)))
+				++level;
+			head = &s.levels[level][(expiry >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1)];
+		}
+
+		e->next = *head;
+		if (NULL != e->next)
+			e->next->pprev = &e->next;
+		e->pprev = head;
+		*head = e;
+	}
+
+	static void unlink(entry* e) {*e->pprev = e->next; if (NULL != e->next) e->next->pprev = e->pprev;}
+
+	//re-link all timers in the given slot, return the index
+	static size_t cascade(shard& s, size_t level, size_t index)
+	{
+		BOOST_AUTO(e, s.levels[level][index]);
+		s.levels[level][index] = NULL;
+		while (NULL != e)
+		{
+			BOOST_AUTO(next, e->next);
+			link(s, e);
+			e = next;
+		}
+
+		return index;
+	}
+
+	static void free_entries(entry*& head)
+	{
+		while (NULL != head)
+		{
+			BOOST_AUTO(e, head);
+			head = e->next;
+			*e->owner = NULL;
+			delete e;
+		}
+	}
+
+private:
+	boost::asio::io_context& io_context;
+	boost::posix_time::ptime begin_time;
+	std::vector<shard*> shards;
+};
+#endif
+
 //timers are identified by id.
 //for the same timer in the same timer object, any manipulations are not thread safe, please pay special attention.
 //to resolve this defect, we must add a mutex member variable to timer_info, it's not worth. otherwise, they are thread safe.
@@ -38,12 +277,15 @@ class timer : public object
 public:
 #ifdef ST_ASIO_USE_STEADY_TIMER
 	typedef boost::chrono::milliseconds milliseconds;
+	typedef boost::chrono::microseconds microseconds;
 	typedef boost::asio::steady_timer timer_type;
 #elif defined(ST_ASIO_USE_SYSTEM_TIMER)
 	typedef boost::chrono::milliseconds milliseconds;
+	typedef boost::chrono::microseconds microseconds;
 	typedef boost::asio::system_timer timer_type;
 #else
 	typedef boost::posix_time::milliseconds milliseconds;
+	typedef boost::posix_time::microseconds microseconds;
 	typedef boost::asio::deadline_timer timer_type;
 #endif
 
@@ -59,24 +301,105 @@ public:
 		timer_status status;
 		size_t interval_ms;
 		boost::function<bool (tid)> call_back; //return true from call_back to continue the timer, or the timer will stop
+#if ST_ASIO_TIMER_WHEEL_TICK > 0
+		timer_wheel::entry* entry; //owned by the timing wheel
+#else
 		boost::shared_ptr<timer_type> timer;
+#endif
 
+#if ST_ASIO_TIMER_WHEEL_TICK > 0
+		timer_info() : seq(-1), status(TIMER_FAKE), interval_ms(0), entry(NULL) {}
+#else
 		timer_info() : seq(-1), status(TIMER_FAKE), interval_ms(0) {}
+#endif
 	};
 
 	typedef const timer_info timer_cinfo;
+#ifdef ST_ASIO_COMPACT_TIMER
+	//a prepend-only lock-free list, timer_info never moves nor been freed before this container, so lookups are thread safe.
+	class container_type : public boost::noncopyable
+	{
+	private:
+		struct node {timer_info item; node* next;};
+
+		template<typename Value, typename Node> struct iterator_base
+		{
+			iterator_base(Node* n_ = NULL) : n(n_) {}
+			Value& operator*() const {return n->item;}
+			Value* operator->() const {return &n->item;}
+			iterator_base& operator++() {n = n->next; return *this;}
+			bool operator==(const iterator_base& other) const {return n == other.n;}
+			bool operator!=(const iterator_base& other) const {return n != other.n;}
+
+			Node* n;
+		};
+
+	public:
+		typedef iterator_base<timer_info, node> iterator;
+		typedef iterator_base<const timer_info, const node> const_iterator;
+
+		container_type() : head(NULL) {}
+		~container_type() {for (BOOST_AUTO(n, head.load(boost::memory_order_acquire)); NULL != n;) {BOOST_AUTO(next, n->next); delete n; n = next;}}
+
+		iterator begin() {return iterator(head.load(boost::memory_order_acquire));}
+		iterator end() {return iterator();}
+		const_iterator begin() const {return const_iterator(head.load(boost::memory_order_acquire));}
+		const_iterator end() const {return const_iterator();}
+
+		const timer_info* find(tid id) const {return find(id, head.load(boost::memory_order_acquire), NULL);}
+		//create a timer_info if not exist
+		timer_info& operator[](tid id)
+		{
+			BOOST_AUTO(old_head, head.load(boost::memory_order_acquire));
+			BOOST_AUTO(ti, find(id, old_head, NULL));
+			if (NULL != ti)
+				return const_cast<timer_info&>(*ti);
+
+			BOOST_AUTO(n, new node());
+			n->item.id = id;
+			for (n->next = old_head; !head.compare_exchange_weak(n->next, n, boost::memory_order_acq_rel, boost::memory_order_acquire); old_head = n->next)
+				if (NULL != (ti = find(id, n->next, old_head))) //created by another thread
+				{
+					delete n;
+					return const_cast<timer_info&>(*ti);
+				}
+
+			return n->item;
+		}
+
+	private:
+		static const timer_info* find(tid id, const node* begin, const node* end)
+			{for (; end != begin; begin = begin->next) if (id == begin->item.id) return &begin->item; return NULL;}
+
+	private:
+		boost::atomic<node*> head;
+	};
+
+	timer(boost::asio::io_context& io_context_) : object(io_context_) {}
+#else
 	typedef std::vector<timer_info> container_type;
 
 	timer(boost::asio::io_context& io_context_) : object(io_context_), timer_can((tid) -1)
 		{tid id = -1; do_something_to_all(boost::lambda::bind(&timer_info::id, boost::lambda::_1) = ++boost::lambda::var(id));}
+#endif
+#if ST_ASIO_TIMER_WHEEL_TICK > 0
+	~timer() //give back entries to the timing wheel, their handlers will not be invoked
+	{
+		timer_wheel& wheel = boost::asio::use_service<timer_wheel>(io_context_);
+		for (BOOST_AUTO(iter, timer_can.begin()); iter != timer_can.end(); ++iter)
+			wheel.remove(iter->entry);
+	}
+#endif
 
 	//after this call, call_back cannot be used again, please note.
 	void update_timer_info(tid id, size_t interval, boost::function<bool(tid)>& call_back, bool start = false)
 	{
 		timer_info& ti = timer_can[id];
 
+#if 0 == ST_ASIO_TIMER_WHEEL_TICK
 		if (timer_info::TIMER_FAKE == ti.status)
 			ti.timer = boost::make_shared<timer_type>(boost::ref(io_context_));
+#endif
 		ti.status = timer_info::TIMER_OK;
 		ti.interval_ms = interval;
 		ti.call_back.swap(call_back);
@@ -111,9 +434,15 @@ public:
 		return true;
 	}
 
+#ifdef ST_ASIO_COMPACT_TIMER
+	timer_info find_timer(tid id) const {BOOST_AUTO(ti, timer_can.find(id)); if (NULL != ti) return *ti; timer_info unused; unused.id = id; return unused;}
+	bool is_timer(tid id) const {BOOST_AUTO(ti, timer_can.find(id)); return NULL != ti && timer_info::TIMER_OK == ti->status;}
+	void stop_timer(tid id) {BOOST_AUTO(ti, timer_can.find(id)); if (NULL != ti) stop_timer(const_cast<timer_info&>(*ti));}
+#else
 	timer_info find_timer(tid id) const {return timer_can[id];}
 	bool is_timer(tid id) const {return timer_info::TIMER_OK == timer_can[id].status;}
 	void stop_timer(tid id) {stop_timer(timer_can[id]);}
+#endif
 	void stop_all_timer() {do_something_to_all(boost::bind((void (timer::*) (timer_info&)) &timer::stop_timer, this, _1));}
 	void stop_all_timer(tid excepted_id)
 	{
@@ -128,20 +457,37 @@ protected:
 	void start_timer(timer_info& ti)
 	{
 		assert(timer_info::TIMER_OK == ti.status);
+#ifdef ST_ASIO_ASYNC_CALL_COUNTER
+		if (is_watching_async_call()) //closing, don't start any timers, they will delay on_all_async_call_end()
+		{
+			ti.status = timer_info::TIMER_CANCELED;
+			return;
+		}
+#endif
 
+#if ST_ASIO_TIMER_WHEEL_TICK > 0
+		timer_wheel& wheel = boost::asio::use_service<timer_wheel>(io_context_);
+		wheel.cancel(ti.entry);
+		wheel.add(ti.entry, ti.interval_ms, make_handler_error(boost::bind(&timer::timer_handler, this, boost::asio::placeholders::error, boost::ref(ti), ++ti.seq)));
+#else
 #if BOOST_ASIO_VERSION >= 101100
 		ti.timer->expires_after(milliseconds(ti.interval_ms));
 #else
 		ti.timer->expires_from_now(milliseconds(ti.interval_ms));
 #endif
 		ti.timer->async_wait(make_handler_error(boost::bind(&timer::timer_handler, this, boost::asio::placeholders::error, boost::ref(ti), ++ti.seq)));
+#endif
 	}
 
 	void stop_timer(timer_info& ti)
 	{
 		if (timer_info::TIMER_OK == ti.status) //enable stopping timers that has been stopped
 		{
+#if ST_ASIO_TIMER_WHEEL_TICK > 0
+			boost::asio::use_service<timer_wheel>(io_context_).cancel(ti.entry);
+#else
 			try {ti.timer->cancel();} catch (const boost::system::system_error& e) {}
+#endif
 			ti.status = timer_info::TIMER_CANCELED;
 		}
 	}
@@ -33,7 +33,11 @@ private:
 	typedef socket<Socket, Packer, Unpacker, in_msg_type, out_msg_type, InQueue, InContainer, OutQueue, OutContainer> super;
 
 public:
+#ifdef ST_ASIO_LOCAL_UNPACKER
+	socket_base(boost::asio::io_context& io_context_) : super(io_context_), unpacker_(boost::make_shared<Unpacker>()), relocate_unpacker(true) {}
+#else
 	socket_base(boost::asio::io_context& io_context_) : super(io_context_), unpacker_(boost::make_shared<Unpacker>()) {}
+#endif
 
 	virtual bool is_ready() {return ST_THIS lowest_layer().is_open();}
 	virtual void send_heartbeat()
@@ -76,7 +80,11 @@ public:
 	//we can resolve this defect via mutex, but i think it's not worth, because this feature is not frequently used
 	boost::shared_ptr<i_unpacker<typename Unpacker::msg_type> > unpacker() {return unpacker_;}
 	boost::shared_ptr<const i_unpacker<typename Unpacker::msg_type> > unpacker() const {return unpacker_;}
+#ifdef ST_ASIO_LOCAL_UNPACKER
+	void unpacker(const boost::shared_ptr<i_unpacker<typename Unpacker::msg_type> >& _unpacker_) {unpacker_ = _unpacker_; relocate_unpacker = false;}
+#else
 	void unpacker(const boost::shared_ptr<i_unpacker<typename Unpacker::msg_type> >& _unpacker_) {unpacker_ = _unpacker_;}
+#endif
 
 	using super::send_msg;
 	///////////////////////////////////////////////////
@@ -128,11 +136,14 @@ protected:
 		if (ST_THIS send_msg_buffer.try_dequeue(last_send_msg))
 		{
 			ST_THIS stat.send_delay_sum += statistic::local_time() - last_send_msg.begin_time;
+#if ST_ASIO_SEND_LINGER > 0
+			ST_THIS send_byte_num.fetch_sub(last_send_msg.size(), boost::memory_order_relaxed);
+#endif
 
 			last_send_msg.restart();
 			boost::lock_guard<boost::mutex> lock(shutdown_mutex);
 			ST_THIS next_layer().async_send_to(ST_ASIO_SEND_BUFFER_TYPE(last_send_msg.data(), last_send_msg.size()), last_send_msg.peer_addr,
-				ST_THIS make_handler_error_size(boost::bind(&socket_base::send_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+				ST_THIS make_handler_error_size(ST_THIS send_mem, boost::bind(&socket_base::send_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
 
 			return true;
 		}
@@ -145,19 +156,27 @@ protected:
 		last_send_msg.swap(msg);
 		boost::lock_guard<boost::mutex> lock(shutdown_mutex);
 		ST_THIS next_layer().async_send_to(ST_ASIO_SEND_BUFFER_TYPE(last_send_msg.data(), last_send_msg.size()), last_send_msg.peer_addr,
-			ST_THIS make_handler_error_size(boost::bind(&socket_base::send_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+			ST_THIS make_handler_error_size(ST_THIS send_mem, boost::bind(&socket_base::send_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
 
 		return true;
 	}
 
 	virtual void do_recv_msg()
 	{
+#ifdef ST_ASIO_LOCAL_UNPACKER
+		if (relocate_unpacker) //re-create the default unpacker in the service thread which serves this socket (see tcp::socket_base)
+		{
+			relocate_unpacker = false;
+			ST_THIS post(boost::bind(&socket_base::relocate_and_recv, this));
+			return;
+		}
+#endif
 		BOOST_AUTO(recv_buff, unpacker_->prepare_next_recv());
 		assert(boost::asio::buffer_size(recv_buff) > 0);
 
 		boost::lock_guard<boost::mutex> lock(shutdown_mutex);
 		ST_THIS next_layer().async_receive_from(recv_buff, temp_addr,
-			ST_THIS make_handler_error_size(boost::bind(&socket_base::recv_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+			ST_THIS make_handler_error_size(ST_THIS recv_mem, boost::bind(&socket_base::recv_handler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
 	}
 
 	virtual void on_recv_error(const boost::system::error_code& ec)
@@ -195,6 +214,10 @@ protected:
 	}
 
 private:
+#ifdef ST_ASIO_LOCAL_UNPACKER
+	void relocate_and_recv() {if (ST_THIS lowest_layer().is_open()) {unpacker_ = boost::make_shared<Unpacker>(); do_recv_msg();}}
+#endif
+
 	void recv_handler(const boost::system::error_code& ec, size_t bytes_transferred)
 	{
 		if (!ec && bytes_transferred > 0)
@@ -280,6 +303,9 @@ private:
 protected:
 	typename super::in_msg last_send_msg;
 	boost::shared_ptr<i_unpacker<typename Unpacker::msg_type> > unpacker_;
+#ifdef ST_ASIO_LOCAL_UNPACKER
+	bool relocate_unpacker; //still using the default unpacker which was created by the constructor
+#endif
 	boost::asio::ip::udp::endpoint local_addr;
 	boost::asio::ip::udp::endpoint temp_addr; //used when receiving messages
 	boost::asio::ip::udp::endpoint peer_addr;